@@ -195,7 +195,15 @@ find_path(ZLIB_H zlib.h PATHS
     )
  
 
-add_compile_definitions(UWS_NO_ZLIB)
+# zlib is needed for permessage-deflate compression, see Ui::set_compression
+find_package(ZLIB QUIET)
+if(ZLIB_FOUND AND NOT NO_COMPRESSION)
+    set(SYSTEM_INCLUDES ${SYSTEM_INCLUDES} ${ZLIB_INCLUDE_DIRS})
+    set(EXT_LIBS ${EXT_LIBS} ${ZLIB_LIBRARIES})
+else()
+    message("No zlib, compression is not available")
+    add_compile_definitions(UWS_NO_ZLIB)
+endif()
 
 
 if(ANDROID OR RASPBERRY)
@@ -6,8 +6,10 @@
 #include <functional>
 #include <memory>
 #include <chrono>
+#include <limits>
 #include <any>
 #include <optional>
+#include <future>
 #include <vector>
 #include <tuple>
 #include <string_view>
@@ -54,6 +56,69 @@ namespace Gempyre {
     struct Event;
     class Element;
 
+    /// @brief Callback of an asynchronous query, e.g. Element::rect_async.
+    /// @details Called in the UI event loop, value is nullopt if the query failed.
+    /// Many queries can be in flight at once, and they are sent together, thus reading 200 elements takes
+    /// about a single round trip. The future variants are set in the UI event loop as well, therefore the future
+    /// must not be waited there - use callbacks or test the future with wait_for.
+    template <class T>
+    using QueryCallback = std::function<void (const std::optional<T>& value)>;
+
+    /// @brief Pointer sample, @see Element::subscribe_pointer.
+    struct PointerSample {
+        /// @brief Pointer event the sample is from.
+        enum class Kind : uint32_t {Down, Move, Up};
+        /// Event time in milliseconds, as the UI reports it.
+        double timestamp;
+        /// Position relative to the element.
+        float x;
+        /// Position relative to the element.
+        float y;
+        /// Pressure in range 0..1.
+        float pressure;
+        /// Pressed buttons, as in MouseEvent.buttons.
+        uint32_t buttons;
+        /// Pointer id, different for each touch.
+        uint32_t pointer_id;
+        /// Event kind.
+        Kind kind;
+    };
+
+    /// @brief Condition an event has to meet to be sent from the UI, @see Element::subscribe.
+    /// @details Properties are compared as the UI represents them as strings, e.g. "Enter" or "true".
+    struct EventFilter {
+        /// @brief Comparison
+        enum class Op {
+            Equals,     ///< property equals the value
+            OneOf,      ///< property equals one of values
+            Range,      ///< min <= property <= max
+            Magnitude   ///< |property| >= min
+        };
+        /// Event property, e.g. "key" or "ctrlKey", it does not have to be one of the subscribed properties.
+        std::string property{};
+        /// Comparison.
+        Op op{Op::Equals};
+        /// Values for Equals and OneOf.
+        std::vector<std::string> values{};
+        /// Lower limit for Range and Magnitude.
+        double min{0};
+        /// Upper limit for Range.
+        double max{0};
+
+        /// Property equals the value, e.g. equals("key", "Enter").
+        static EventFilter equals(std::string_view property, std::string_view value) {
+            return EventFilter{std::string{property}, Op::Equals, {std::string{value}}};}
+        /// Property is one of the values, e.g. one_of("key", {"ArrowUp", "ArrowDown"}).
+        static EventFilter one_of(std::string_view property, const std::vector<std::string>& values) {
+            return EventFilter{std::string{property}, Op::OneOf, values};}
+        /// Numeric property is within the range.
+        static EventFilter range(std::string_view property, double min, double max) {
+            return EventFilter{std::string{property}, Op::Range, {}, min, max};}
+        /// Numeric property magnitude is at least the threshold, e.g. magnitude("deltaY", 10).
+        static EventFilter magnitude(std::string_view property, double min) {
+            return EventFilter{std::string{property}, Op::Magnitude, {}, min};}
+    };
+
     class GEMPYRE_EX HtmlStream : public std::ostringstream {
         public:
             ~HtmlStream();
@@ -91,8 +156,90 @@ namespace Gempyre {
         using Elements = std::vector<Element>;
         /// @brief Callback function for event subscriptions. @see Element::subscribe.
         using SubscribeFunction = std::function<void(const Event&)>;
+        /// @brief Callback function for pointer samples. @see Element::subscribe_pointer.
+        using PointerFunction = std::function<void(const Element& element, const std::vector<PointerSample>& samples)>;
          /// @brief compatibility @see Gempyre::Rect.
         using Rect = Gempyre::Rect;
+        /// @brief Change the UI applies on an event without a round trip, @see Element::bind.
+        struct Action {
+            /// @brief What is changed
+            enum class Op {SetStyle, RemoveStyle, AddClass, RemoveClass, ToggleClass, SetAttribute, RemoveAttribute, Show, Hide, ToggleHidden, Focus};
+            /// Id of the changed element.
+            std::string target{};
+            /// Change.
+            Op op{Op::SetStyle};
+            /// Style, class or attribute name.
+            std::string name{};
+            /// Style or attribute value.
+            std::string value{};
+
+            /// Set a CSS style of the target.
+            static Action set_style(const Element& target, std::string_view style, std::string_view value) {
+                return Action{target.id(), Op::SetStyle, std::string{style}, std::string{value}};}
+            /// Remove a CSS style of the target.
+            static Action remove_style(const Element& target, std::string_view style) {
+                return Action{target.id(), Op::RemoveStyle, std::string{style}};}
+            /// Add a class to the target.
+            static Action add_class(const Element& target, std::string_view className) {
+                return Action{target.id(), Op::AddClass, std::string{className}};}
+            /// Remove a class from the target.
+            static Action remove_class(const Element& target, std::string_view className) {
+                return Action{target.id(), Op::RemoveClass, std::string{className}};}
+            /// Add a class to the target if it does not have it, otherwise remove.
+            static Action toggle_class(const Element& target, std::string_view className) {
+                return Action{target.id(), Op::ToggleClass, std::string{className}};}
+            /// Set an attribute of the target.
+            static Action set_attribute(const Element& target, std::string_view attr, std::string_view value) {
+                return Action{target.id(), Op::SetAttribute, std::string{attr}, std::string{value}};}
+            /// Remove an attribute of the target.
+            static Action remove_attribute(const Element& target, std::string_view attr) {
+                return Action{target.id(), Op::RemoveAttribute, std::string{attr}};}
+            /// Show the target, i.e. clear its hidden attribute.
+            static Action show(const Element& target) {return Action{target.id(), Op::Show};}
+            /// Hide the target.
+            static Action hide(const Element& target) {return Action{target.id(), Op::Hide};}
+            /// Show the target if it is hidden, otherwise hide.
+            static Action toggle_hidden(const Element& target) {return Action{target.id(), Op::ToggleHidden};}
+            /// Move focus to the target.
+            static Action focus(const Element& target) {return Action{target.id(), Op::Focus};}
+        };
+
+        /// @brief How the UI sends events of a subscription, @see Element::subscribe.
+        enum class Delivery {
+            Throttle,           ///< Events closer than the throttle period to the previous one are dropped, default.
+            ThrottleTrailing,   ///< As Throttle, but the last dropped event of a burst is sent when the period ends.
+            Debounce,           ///< An event is sent when no other has followed it within the throttle period.
+            Frame               ///< Events are collected and sent once per animation frame in a single message, throttle is not used.
+        };
+        /// @brief How events waiting for their handler are merged, @see Element::set_coalesce.
+        enum class Coalesce {
+            None,           ///< Every event is handled, default.
+            Latest,         ///< Only the latest waiting event is handled.
+            FirstAndLast,   ///< The first and the latest waiting events are handled.
+            Accumulate      ///< As Latest, but the given delta properties are summed over the merged events.
+        };
+        /// @brief Serialized DOM node, @see Element::snapshot.
+        struct Node {
+            /// Element type, mostly a HTML tag.
+            std::string type{};
+            /// Element id, empty if the element has none.
+            std::string id{};
+            /// Selected attributes the element has.
+            Attributes attributes{};
+            /// Text of the element itself, i.e. not its children, whitespace trimmed.
+            std::string text{};
+            /// Child elements, empty below the depth limit.
+            std::vector<Node> children{};
+        };
+        /// @brief Mirrored property value, @see Element::mirror.
+        struct Mirrored {
+            /// Value as last pushed by the UI.
+            std::string value{};
+            /// Time the value was received.
+            std::chrono::steady_clock::time_point updated{};
+            /// A change to the property has been sent after the value was pushed, the UI pushes the value again once it has applied the change.
+            bool stale{false};
+        };
 
     public:
         /// Copy constructor.
@@ -133,13 +280,41 @@ namespace Gempyre {
         /// @param name - name of the event. 
         /// @param handler - function executed on event.
         /// @param properties - optional, event properties to listen.
-        /// @param throttle - optional, throttle callback calls
+        /// @param throttle - optional, throttle callback calls, not used with Delivery::Frame.
+        /// @param delivery - optional, how throttle is applied, @see Delivery.
+        /// @param filters - optional, conditions that all have to be met for an event to be sent, @see EventFilter.
         /// @return this element
         /// @details Listen element events. The callback properties is populated only with values listed in properties parameter.
         /// Some events (like mouse move) can emit so often that it would impact to performance, that can be eased
         /// with a suitable throttle value. If two (or more) messages are received in shorted period than throttle value, only the
-        /// last is received.
-        Element& subscribe(std::string_view name, const SubscribeFunction& handler, const std::vector<std::string>& properties = {}, const std::chrono::milliseconds& throttle = 0ms);
+        /// last is received. Use Delivery::ThrottleTrailing or Delivery::Debounce when the final event of a burst matters,
+        /// e.g. the last resize, and Delivery::Frame to send all events of a frame together. Filters are evaluated in the UI,
+        /// so events the handler would ignore are not sent at all.
+        Element& subscribe(std::string_view name, const SubscribeFunction& handler, const std::vector<std::string>& properties = {},
+            const std::chrono::milliseconds& throttle = 0ms, Delivery delivery = Delivery::Throttle, const std::vector<EventFilter>& filters = {});
+        /// @brief Apply actions in the UI when this element emits an event.
+        /// @param name - event name, @see subscribe.
+        /// @param actions - changes applied in order, @see Action.
+        /// @param notify - optional, called after the UI has applied the actions.
+        /// @param filters - optional, conditions that all have to be met for the actions to apply, @see EventFilter.
+        /// @return this element
+        /// @details Actions are registered once and run in the UI, e.g. hover highlights and show/hide on click
+        /// do not need a round trip to the application.
+        Element& bind(std::string_view name, const std::vector<Action>& actions, const SubscribeFunction& notify = nullptr, const std::vector<EventFilter>& filters = {});
+        /// @brief Listen pointer samples of this element.
+        /// @param handler - callback called with the samples received in one message.
+        /// @return this element
+        /// @details Pointer down, move and up events, including the samples the browser coalesces into a move
+        /// event, are collected and sent once per frame as a binary message.
+        Element& subscribe_pointer(const PointerFunction& handler);
+        /// @brief Merge events of a subscription that wait for the handler.
+        /// @param name - event name, @see subscribe.
+        /// @param coalesce - coalescing policy.
+        /// @param deltas - numeric properties summed with Coalesce::Accumulate, e.g. "movementX" or "deltaY".
+        /// @return this element
+        /// @details When the application is busy, high frequency events like mousemove, scroll or input pile up and
+        /// each of them is handled. Coalescing keeps only the state the handler needs. @see Ui::Traffic.
+        Element& set_coalesce(std::string_view name, Coalesce coalesce, const std::vector<std::string>& deltas = {});
         /// @brief Set HTML text value of the element
         /// @param htmlText - HTML encoded string
         /// @return this element
@@ -158,6 +333,10 @@ namespace Gempyre {
         Element& set_attribute(std::string_view attr);
         /// Get this element attributes 
         std::optional<Attributes> attributes() const;
+        /// Get this element attributes asynchronously, @see QueryCallback.
+        void attributes_async(const QueryCallback<Attributes>& callback) const;
+        /// Get this element attributes asynchronously, @see QueryCallback.
+        [[nodiscard]] std::future<std::optional<Attributes>> attributes_async() const;
         /// @brief Set CSS style of this element
         /// @param style - style name 
         /// @param value - CSS style value
@@ -170,20 +349,64 @@ namespace Gempyre {
         /// @brief Get element styles
         /// @param keys - style keys to fetch.
         [[nodiscard]] std::optional<Values> styles(const std::vector<std::string>& keys) const;
+        /// Get element styles asynchronously, @see QueryCallback.
+        void styles_async(const std::vector<std::string>& keys, const QueryCallback<Values>& callback) const;
+        /// Get element styles asynchronously, @see QueryCallback.
+        [[nodiscard]] std::future<std::optional<Values>> styles_async(const std::vector<std::string>& keys) const;
         /// Get element children
         [[nodiscard]] std::optional<Elements> children() const;
+        /// Get element children asynchronously, @see QueryCallback.
+        void children_async(const QueryCallback<Elements>& callback) const;
+        /// Get element children asynchronously, @see QueryCallback.
+        [[nodiscard]] std::future<std::optional<Elements>> children_async() const;
         /// Applies to form elements only - receive values bound to the element
         [[nodiscard]] std::optional<Values> values() const;
+        /// Get values asynchronously, @see QueryCallback.
+        void values_async(const QueryCallback<Values>& callback) const;
+        /// Get values asynchronously, @see QueryCallback.
+        [[nodiscard]] std::future<std::optional<Values>> values_async() const;
         /// Get HTML value bound to this element (does not apply all elements)
         [[nodiscard]] std::optional<std::string> html() const;
+        /// Get HTML value asynchronously, @see QueryCallback.
+        void html_async(const QueryCallback<std::string>& callback) const;
+        /// Get HTML value asynchronously, @see QueryCallback.
+        [[nodiscard]] std::future<std::optional<std::string>> html_async() const;
+        /// @brief Get this element and its descendants in a single query.
+        /// @param attributes - attributes to include.
+        /// @param depth - levels of children to include, 0 is the element only.
+        /// @details Elements without an id are not given one, unlike in children().
+        [[nodiscard]] std::optional<Node> snapshot(const std::vector<std::string>& attributes = {}, unsigned depth = std::numeric_limits<unsigned>::max()) const;
+        /// Get a snapshot asynchronously, @see QueryCallback.
+        void snapshot_async(const std::vector<std::string>& attributes, unsigned depth, const QueryCallback<Node>& callback) const;
+        /// @brief Mirror properties of this element, the UI pushes their changes and they can be read without a query.
+        /// @param properties - "value", "checked", "innerHTML" or "attribute:<name>", empty stops mirroring.
+        /// @details Values and checked state are pushed on input and change events, innerHTML and attributes when the
+        /// document changes. Changes are coalesced, so a burst of edits results in a single update.
+        Element& mirror(const std::vector<std::string>& properties);
+        /// @brief Get a mirrored property
+        /// @param property - property name, @see mirror.
+        /// @return nullopt if property is not mirrored or the UI has not yet pushed it.
+        [[nodiscard]] std::optional<Mirrored> mirrored(std::string_view property) const;
         /// Remove this element from UI
         void remove();
         /// Get this element type, mostly a HTML tag.
         [[nodiscard]] std::optional<std::string> type() const;
+        /// Get this element type asynchronously, @see QueryCallback.
+        void type_async(const QueryCallback<std::string>& callback) const;
+        /// Get this element type asynchronously, @see QueryCallback.
+        [[nodiscard]] std::future<std::optional<std::string>> type_async() const;
         /// Get this element UI rect. I.e area it occupies on screen (if applicable)
         [[nodiscard]] std::optional<Rect> rect() const;
+        /// Get this element UI rect asynchronously, @see QueryCallback.
+        void rect_async(const QueryCallback<Rect>& callback) const;
+        /// Get this element UI rect asynchronously, @see QueryCallback.
+        [[nodiscard]] std::future<std::optional<Rect>> rect_async() const;
         /// Parent of this element. If query fails, element is root or parent id is not set, nullopt is returned.
         [[nodiscard]] std::optional<Element> parent() const; 
+        /// Parent of this element asynchronously, @see QueryCallback.
+        void parent_async(const QueryCallback<Element>& callback) const;
+        /// Parent of this element asynchronously, @see QueryCallback.
+        [[nodiscard]] std::future<std::optional<Element>> parent_async() const;
     protected:
     /// @cond INTERNAL    
         const GempyreInternal& ref() const;
@@ -197,6 +420,65 @@ namespace Gempyre {
         friend class GempyreInternal;
     };
 
+    /// @cond INTERNAL
+    struct EventData;
+    /// @endcond
+
+    /// @brief Event properties as strings, @see Event.
+    /// @details Properties are kept as the UI sent them and converted to strings only when first accessed.
+    class GEMPYRE_EX EventProperties {
+    public:
+        /// String map of the properties.
+        using map_type = std::unordered_map<std::string, std::string>;
+        /// Empty properties.
+        EventProperties() = default;
+        /// Properties from strings.
+        EventProperties(map_type&& properties) : m_map{std::move(properties)} {}
+        /// @cond INTERNAL
+        explicit EventProperties(std::shared_ptr<const EventData> data) : m_data{std::move(data)} {}
+        /// @endcond
+
+        /// Get a property as a string, throws std::out_of_range if not found.
+        const std::string& at(const std::string& key) const {return map().at(key);}
+        /// Find a property.
+        map_type::const_iterator find(const std::string& key) const {return map().find(key);}
+        /// Begin iterator.
+        map_type::const_iterator begin() const {return map().begin();}
+        /// End iterator.
+        map_type::const_iterator end() const {return map().end();}
+        /// Number of found properties, 0 or 1.
+        size_t count(const std::string& key) const {return map().count(key);}
+        /// Number of properties.
+        size_t size() const {return map().size();}
+        /// True if there are no properties.
+        bool empty() const {return map().empty();}
+        /// String map of the properties.
+        operator const map_type&() const {return map();}
+        /// String map of the properties.
+        const map_type& map() const;
+
+        /// @brief Get a property as its UI type, without string conversion.
+        /// @tparam T - double, float, int, unsigned, long long, bool or std::string. A string is parsed if a number is asked.
+        /// @return nullopt if property is not found or it cannot be represented as T, e.g. a fraction or a negative
+        /// number as an unsigned.
+        template <class T>
+        std::optional<T> get(std::string_view key) const;
+
+    private:
+        std::shared_ptr<const EventData> m_data{};
+        mutable std::optional<map_type> m_map{};
+    };
+
+    /// @cond INTERNAL
+    extern template GEMPYRE_EX std::optional<double> EventProperties::get<double>(std::string_view) const;
+    extern template GEMPYRE_EX std::optional<float> EventProperties::get<float>(std::string_view) const;
+    extern template GEMPYRE_EX std::optional<int> EventProperties::get<int>(std::string_view) const;
+    extern template GEMPYRE_EX std::optional<unsigned> EventProperties::get<unsigned>(std::string_view) const;
+    extern template GEMPYRE_EX std::optional<long long> EventProperties::get<long long>(std::string_view) const;
+    extern template GEMPYRE_EX std::optional<bool> EventProperties::get<bool>(std::string_view) const;
+    extern template GEMPYRE_EX std::optional<std::string> EventProperties::get<std::string>(std::string_view) const;
+    /// @endcond
+
     /// @brief Event received
     struct Event {
         /// Mouse moving
@@ -239,7 +521,11 @@ namespace Gempyre {
         /// @brief element that has emitted the event, the same that did subscription.
         Element element;
         /// @brief List of requested properties. @see Element::subscribe()
-        std::unordered_map<std::string, std::string> properties;
+        EventProperties properties;
+
+        /// @brief Get a property as its UI type, e.g. get<double>("clientX"), @see EventProperties::get.
+        template <class T>
+        std::optional<T> get(std::string_view key) const {return properties.get<T>(key);}
     };
 
     /// @brief The application UI 
@@ -262,6 +548,71 @@ namespace Gempyre {
         /// Resource map type
         using FileMap = std::vector<std::pair<std::string, std::string>>;
 
+        /// @brief Encoding of the messages between Gempyre and UI, @see Ui::set_encoding.
+        enum class Encoding {Json, MsgPack};
+
+        /// @brief Compression of the messages sent to UI, @see Ui::set_compression.
+        enum class Compression {
+            Off,    ///< No compression.
+            Text,   ///< Compress control messages, e.g. set_html and query responses.
+            All     ///< Compress also bitmaps.
+        };
+
+        /// @brief Send priority of the messages to UI, @see Ui::set_lane.
+        enum class Lane {
+            Interactive,    ///< Sent before bulk messages, default for all but droppable bitmaps.
+            Bulk            ///< Sent when there are no interactive messages waiting, default for droppable bitmaps.
+        };
+
+        /// @brief Queried properties of elements, in the document order for a selector, @see Ui::properties.
+        using ElementProperties = std::vector<std::pair<Element, Element::Values>>;
+
+        /// @brief Time messages of a lane wait in the send queue, @see Traffic.
+        struct LaneDelay {
+            /// Messages sent.
+            size_t messages{0};
+            /// Average wait.
+            std::chrono::microseconds average{0};
+            /// Longest wait.
+            std::chrono::microseconds max{0};
+        };
+
+        /// @brief UI connection message counters, @see Ui::traffic.
+        struct Traffic {
+            /// Messages sent to UI, including bitmaps.
+            size_t messages_sent{0};
+            /// Bytes sent to UI.
+            size_t bytes_sent{0};
+            /// Messages received from UI.
+            size_t messages_received{0};
+            /// Bytes received from UI.
+            size_t bytes_received{0};
+            /// Encoding that UI connection uses.
+            Encoding encoding{Encoding::Json};
+            /// Batched set_html, set_attribute and set_style operations not sent as a later one wrote the same property.
+            size_t operations_coalesced{0};
+            /// Messages sent compressed, @see Ui::set_compression.
+            size_t compressed_messages{0};
+            /// Compressed size relative to the original size of the compressed messages, estimated from a sample.
+            double compression_ratio{1.0};
+            /// Time spent to compress the messages, estimated from a sample.
+            std::chrono::microseconds compression_time{0};
+            /// Large messages and bitmaps that UI fetched over HTTP instead of the websocket.
+            size_t messages_pulled{0};
+            /// Bytes of the pulled messages.
+            size_t bytes_pulled{0};
+            /// Queueing delay of interactive messages.
+            LaneDelay interactive{};
+            /// Queueing delay of bulk messages.
+            LaneDelay bulk{};
+            /// Events waiting for their handlers.
+            size_t events_queued{0};
+            /// Most events that have been waiting at once.
+            size_t events_max_queued{0};
+            /// Events merged to a waiting one, @see Element::set_coalesce.
+            size_t events_coalesced{0};
+        };
+
         /// @cond INTERNAL
         using TimerId = int;
         static constexpr unsigned short UseDefaultPort = 0; //zero means default port
@@ -394,10 +745,39 @@ namespace Gempyre {
         
         /// Get elements by class name
         [[nodiscard]] std::optional<Element::Elements> by_class(std::string_view className) const;
+
+        /// Get elements by class name asynchronously, @see QueryCallback.
+        void by_class_async(std::string_view className, const QueryCallback<Element::Elements>& callback) const;
+
+        /// Get elements by class name asynchronously, @see QueryCallback.
+        [[nodiscard]] std::future<std::optional<Element::Elements>> by_class_async(std::string_view className) const;
         
         /// Get elements by name
         [[nodiscard]] std::optional<Element::Elements> by_name(std::string_view className) const;
+
+        /// Get elements by name asynchronously, @see QueryCallback.
+        void by_name_async(std::string_view name, const QueryCallback<Element::Elements>& callback) const;
+
+        /// Get elements by name asynchronously, @see QueryCallback.
+        [[nodiscard]] std::future<std::optional<Element::Elements>> by_name_async(std::string_view name) const;
         
+        /// @brief Get properties of many elements in a single query.
+        /// @param elements - elements to query, the ones not found are omitted from the result.
+        /// @param properties - "x", "y", "width", "height" of the element rect, "value", "checked", "name", "type",
+        /// "innerHTML", "attribute:<name>" or "style:<name>" of the computed style.
+        [[nodiscard]] std::optional<ElementProperties> properties(const Element::Elements& elements, const std::vector<std::string>& properties) const;
+
+        /// @brief Get properties of all elements matching a CSS selector in a single query.
+        /// @param selector - CSS selector, e.g. ".item" or "#list > li"
+        /// @param properties - see above.
+        [[nodiscard]] std::optional<ElementProperties> properties(std::string_view selector, const std::vector<std::string>& properties) const;
+
+        /// Get properties of many elements asynchronously, @see QueryCallback.
+        void properties_async(const Element::Elements& elements, const std::vector<std::string>& properties, const QueryCallback<ElementProperties>& callback) const;
+
+        /// Get properties of elements matching a CSS selector asynchronously, @see QueryCallback.
+        void properties_async(std::string_view selector, const std::vector<std::string>& properties, const QueryCallback<ElementProperties>& callback) const;
+
         /// Test function to measure round trip time
         [[nodiscard]] std::optional<std::pair<std::chrono::microseconds, std::chrono::microseconds>> ping() const;
         
@@ -442,6 +822,17 @@ namespace Gempyre {
         
         /// Ends an UI read batch, push all stored messages at once.
         void end_batch();
+
+        /// @brief Send UI operations in batches automatically.
+        /// @details When on (default), all operations requested during an event loop round, e.g. in timer callbacks
+        /// and event handlers, are sent as a single message at the end of the round. Large batches are split.
+        /// Within a batch only the last set_html, set_attribute or set_style of the same element property is sent,
+        /// @see Traffic::operations_coalesced.
+        /// @param auto_batch false sends each operation as its own message.
+        void set_auto_batch(bool auto_batch);
+
+        /// Tells if operations are batched automatically.
+        [[nodiscard]] bool is_auto_batch() const;
         
         /// Set all timers to hold. Can be used to pause UI actions.
         void set_timer_on_hold(bool on_hold);
@@ -451,6 +842,12 @@ namespace Gempyre {
         
         /// Get an native UI device pixel ratio.
         [[nodiscard]] std::optional<double> device_pixel_ratio() const;
+
+        /// Get an native UI device pixel ratio asynchronously, @see QueryCallback.
+        void device_pixel_ratio_async(const QueryCallback<double>& callback) const;
+
+        /// Get an native UI device pixel ratio asynchronously, @see QueryCallback.
+        [[nodiscard]] std::future<std::optional<double>> device_pixel_ratio_async() const;
         
         /// Set application icon, fail silently if backend wont support
         void set_application_icon(const uint8_t* data, size_t dataLen, std::string_view type);
@@ -467,6 +864,34 @@ namespace Gempyre {
         /// Write pending requests to UI - e.g. when eventloop thread is blocked.
         void flush();
 
+        /// @brief Set encoding of the messages between Gempyre and UI.
+        /// @param encoding MsgPack (default) is used when the UI supports it, Json keeps messages as text that
+        /// is easier to read e.g. in the browser developer tools. Applies to connections made after the call.
+        void set_encoding(Encoding encoding);
+
+        /// @brief Set permessage-deflate compression of the messages sent to UI.
+        /// @details Worth of it when UI is on a remote host. Has to be set before run, and requires Gempyre built with zlib.
+        /// Messages over 1 MB are fetched by UI over HTTP and compressed there, except canvas tiles that can be
+        /// dropped under load, they stay on the websocket and are not compressed.
+        /// @param compression Off (default), Text or All.
+        /// @param min_size smaller messages are not compressed.
+        /// @param level 0 uses a compressor shared by connections, 1 - 8 a dedicated compressor per connection
+        /// with a window from 3 kB to 256 kB that compresses better, but uses more memory.
+        void set_compression(Compression compression, size_t min_size = 1024, int level = 0);
+
+        /// @brief Set send priority of a message type.
+        /// @details An interactive message, e.g. a query, does not wait behind queued bitmaps, but bulk messages get
+        /// their turn after a run of interactive ones. Messages keep their order only within a lane. By default only
+        /// the canvas frames that can be dropped under load are bulk, so DOM updates keep their order with the other
+        /// bitmaps. Setting "binary" to Bulk moves all bitmaps behind the interactive messages. A batch is
+        /// interactive if any of its operations is.
+        /// @param type message type, e.g. "query", "html", "set_style" or "binary" for bitmaps.
+        /// @param lane Interactive or Bulk.
+        void set_lane(const std::string& type, Lane lane);
+
+        /// @brief Get message counters of the UI connection.
+        [[nodiscard]] Traffic traffic() const;
+
         /// test if Element can be accessed. Note that in false it's may be in HTML, but not available in DOM tree.
         bool available(std::string_view id) const; 
 
@@ -28,6 +28,7 @@
 
 namespace  Gempyre {
     class CanvasElement;
+    class CanvasLayers;
 
     /// @brief RGB handling
     namespace  Color {
@@ -270,6 +271,7 @@ namespace  Gempyre {
         /// @endcond
     private:
         friend class Gempyre::CanvasElement;
+        friend class Gempyre::CanvasLayers;
         Gempyre::CanvasDataPtr m_canvas{};
     };
 
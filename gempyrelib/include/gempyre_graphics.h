@@ -44,6 +44,22 @@ public:
     
     /// set initial draw, @see CanvasElement::draw_completed()
     enum class DrawNotify{NoKick, Kick};
+
+    /// @brief How client scales render pixels to the screen, @see CanvasElement::set_render_scale.
+    enum class Smoothing{Nearest, Smooth};
+
+    /// @brief Function type for render size changes, @see CanvasElement::set_render_scale.
+    using ResizeCallback = std::function<void(int width, int height)>;
+
+    /// @brief Bitmap draw quality levels, @see CanvasElement::set_adaptive_quality.
+    /// - Full: bitmaps are sent as they are.
+    /// - Reduced: bitmaps are sent at half resolution.
+    /// - Lossy: bitmaps are sent at half resolution with 16 bit colors.
+    /// - Minimal: bitmaps are sent at quarter resolution with 16 bit colors and draw_completed is called less often.
+    enum class Quality{Full, Reduced, Lossy, Minimal};
+
+    /// @brief Function type for quality changes, @see CanvasElement::set_adaptive_quality.
+    using QualityCallback = std::function<void(Quality quality)>;
     
     /// Destructor.
     ~CanvasElement();
@@ -131,17 +147,115 @@ public:
     /// @brief erase bitmap
     /// @param resized - make an explicit query to ask canvas current size
     void erase(bool resized = false);
+
+    /// @brief Let canvas backing store to follow its size on screen.
+    /// @param scale render pixels per CSS pixel, 0 follows the device pixel ratio.
+    /// @param smoothing how the client scales render pixels on the screen, Nearest suits for pixel art.
+    /// @param onResize optional callback called when render size changes (or is known first time), canvas content is lost on resize and shall be redrawn. 
+    /// @details All draws are then in render pixels, e.g. scale 1 on HiDPI display lets application to render at CSS size and browser upscales it.
+    /// Backing store is resized on the client on resize and device pixel ratio changes, and the new size is reported without queries.
+    /// The canvas size should be set by CSS, if it is only defined by the canvas width and height it get pinned to current size.
+    void set_render_scale(double scale, Smoothing smoothing = Smoothing::Smooth, const ResizeCallback& onResize = nullptr);
+
+    /// @brief Get size of canvas in render pixels.
+    /// @return width and height, if set_render_scale is applied and the client has reported the size.
+    std::optional<std::pair<int, int>> render_size() const;
+
+    /// @brief Adapt bitmap draw quality to the connection.
+    /// @param adaptive when true, bitmap draws lower their quality when data is not drained fast enough, and recover when bandwidth returns.
+    /// @param onChange optional callback called when quality level changes.
+    /// @details The client scales the bitmap back to its size, hence the application draws as usual.
+    void set_adaptive_quality(bool adaptive, const QualityCallback& onChange = nullptr);
+
+    /// @brief Get current bitmap draw quality.
+    /// @return quality level, Full if adaptive quality is not set.
+    Quality quality() const;
 private:
     friend class Bitmap;
-    void paint(const CanvasDataPtr& canvas, int x, int y, bool as_draw);
+    friend class CanvasLayers;
+    void paint(const CanvasDataPtr& canvas, int x, int y, bool as_draw, dataT flags = 0);
 private:
+    struct RenderScale;
+    struct Adaptive;
     CanvasDataPtr m_tile{};
+    std::shared_ptr<RenderScale> m_render{};
+    std::shared_ptr<Adaptive> m_adaptive{};
     int m_width{0};
     int m_height{0};
 };
 
+/// @brief Stack of canvases composed on the client.
+/// @details Each layer is a Bitmap of the same size, upper layers are transparent where their alpha is 0.
+/// On present only areas changed since the previous present are sent, and all layers are updated at once on the client.
+/// @note
+/// @code{.cpp}
+/// Gempyre::CanvasLayers layers(ui, ui.root(), 800, 600, 2);
+/// layers.layer(0).draw_rect({0, 0, 800, 600}, Gempyre::Color::White);
+/// layers.layer(1).draw_rect({x, y, 10, 10}, Gempyre::Color::Red); // cursor
+/// layers.present();
+/// @endcode
+class GEMPYRE_EX CanvasLayers : public Element {
+public:
+    /// @brief Constructor to create a new CanvasLayers.
+    /// @param ui ref
+    /// @param parent parent element
+    /// @param width width of layers in pixels
+    /// @param height height of layers in pixels
+    /// @param layers number of layers, layer 0 is the bottom one
+    CanvasLayers(Ui& ui, const Element& parent, int width, int height, int layers);
+
+    /// @brief Constructor to create a new CanvasLayers.
+    /// @param ui ref
+    /// @param id HTML id of the container element
+    /// @param parent parent element
+    /// @param width width of layers in pixels
+    /// @param height height of layers in pixels
+    /// @param layers number of layers, layer 0 is the bottom one
+    CanvasLayers(Ui& ui, std::string_view id, const Element& parent, int width, int height, int layers);
+
+    /// Destructor.
+    ~CanvasLayers();
+
+    /// @brief Number of layers.
+    [[nodiscard]] int count() const;
+
+    /// @brief Layer width.
+    [[nodiscard]] int width() const;
+
+    /// @brief Layer height.
+    [[nodiscard]] int height() const;
+
+    /// @brief Get layer bitmap to draw on.
+    /// @param index layer index.
+    /// @return Bitmap that is sent on present.
+    Bitmap& layer(int index);
+
+    /// @brief Get layer canvas element, e.g. to subscribe its events.
+    /// @param index layer index.
+    /// @return CanvasElement of the layer.
+    CanvasElement canvas(int index) const;
+
+    /// @brief Send whole layer on next present.
+    /// @param index layer index.
+    void invalidate(int index);
+
+    /// @brief Send changed areas of all layers, the client shows them at once.
+    /// @return number of areas sent, if 0 nothing is sent and no draw completion follows.
+    size_t present();
+
+    /// @brief Set a callback to be called after a present is shown, @see CanvasElement::draw_completed.
+    /// @param drawCompletedCallback - function called after present.
+    /// @param kick - optional whether callback is called 1st time automatically.
+    void draw_completed(const CanvasElement::DrawCallback& drawCompletedCallback, CanvasElement::DrawNotify kick = CanvasElement::DrawNotify::NoKick);
+private:
+    void create_layers(int width, int height, int layers);
+private:
+    struct Layers;
+    std::shared_ptr<Layers> m_layers{};
+};
+
 /// @brief - wrap up Javascript draw commands.
-class FrameComposer {
+class GEMPYRE_EX FrameComposer {
 public:
     /// @brief Constructor.
     FrameComposer() {}
@@ -226,6 +340,13 @@ public:
     FrameComposer text_baseline(const std::string& textBaseline) {return push({"textBaseline", textBaseline});}
     /// @brief Get command list composed.
     [[nodiscard]] const Gempyre::CanvasElement::CommandList& composed() const {return m_composition;}
+    /// @brief Remove redundant commands from the composition.
+    /// @details Drops state sets (fill_style, stroke_style, line_width, font, text_align, text_baseline) that does not change
+    /// the current value or are overridden before used, removes empty save/restore pairs and merges edge-adjacent
+    /// fill_rect and clear_rect commands into a single rectangle. The composition is left untouched if it contains commands
+    /// the pass does not know.
+    /// @return number of commands removed.
+    std::size_t optimize();
 private:
     FrameComposer push(const std::initializer_list<Gempyre::CanvasElement::Command>& list) {m_composition.insert(m_composition.end(), list); return *this;}
     Gempyre::CanvasElement::CommandList m_composition{};
@@ -0,0 +1,182 @@
+#ifndef GEMPYRE_PYRAMID_H
+#define GEMPYRE_PYRAMID_H
+
+#include <gempyre_graphics.h>
+#include <functional>
+#include <memory>
+
+/**
+  * @file
+  *
+  * ![wqe](https://avatars1.githubusercontent.com/u/7837709?s=400&v=4)
+  *
+  * gempyre_pyramid.h API for viewing very large images as a tiled image pyramid
+  *
+  */
+
+
+#ifdef WINDOWS_EXPORT
+    #ifndef GEMPYRE_EX
+        #define GGEMPYRE_EX __declspec( dllexport )
+    //#else
+    //    #define GEMPYRE_EX
+    #endif
+#endif
+
+namespace  Gempyre {
+
+/// @brief Tiled image pyramid file, memory mapped for reading.
+/// @details Level 0 is the full resolution image, each next level is a half size box downscaled copy of
+/// the previous one until the level fits in a single tile. Each level is stored as square RGBA tiles in a row order,
+/// tiles on the right and bottom edges are padded.
+/// @code{.cpp}
+/// Gempyre::Pyramid::build("image.pyr", width, height, [&](int y, Gempyre::Color::type* row) {
+///     return decoder.read_row(y, row);
+/// });
+/// const auto pyramid = Gempyre::Pyramid::open("image.pyr");
+/// @endcode
+class GEMPYRE_EX Pyramid {
+public:
+    /// @brief Function to read a row of the full resolution image, @see Pyramid::build.
+    /// @details Rows are read in order from the top. Row has to be filled with width pixels. Return false to abort.
+    using RowReader = std::function<bool (int y, Color::type* row)>;
+
+    /// @brief Default tile size in pixels.
+    static constexpr int DEFAULT_TILE_SIZE = 256;
+
+    /// @brief Write a pyramid file.
+    /// @param path file to write.
+    /// @param width image width.
+    /// @param height image height.
+    /// @param reader function that provides the image rows.
+    /// @param tile_size width and height of a tile.
+    /// @return true if the file was written.
+    static bool build(const std::string& path, int width, int height, const RowReader& reader, int tile_size = DEFAULT_TILE_SIZE);
+
+    /// @brief Write a pyramid file from a bitmap.
+    /// @param path file to write.
+    /// @param bitmap image.
+    /// @param tile_size width and height of a tile.
+    /// @return true if the file was written.
+    static bool build(const std::string& path, const Bitmap& bitmap, int tile_size = DEFAULT_TILE_SIZE);
+
+    /// @brief Memory map a pyramid file.
+    /// @param path file to open.
+    /// @return pyramid or nullptr if the file cannot be mapped or is not a valid pyramid.
+    static std::shared_ptr<Pyramid> open(const std::string& path);
+
+    /// Destructor - unmaps the file.
+    ~Pyramid();
+
+    Pyramid(const Pyramid& other) = delete;
+    Pyramid& operator=(const Pyramid& other) = delete;
+
+    /// @brief Full resolution image width.
+    [[nodiscard]] int width() const;
+    /// @brief Full resolution image height.
+    [[nodiscard]] int height() const;
+    /// @brief Tile width and height.
+    [[nodiscard]] int tile_size() const;
+    /// @brief Number of levels.
+    [[nodiscard]] int levels() const;
+    /// @brief Image width on a level.
+    [[nodiscard]] int level_width(int level) const;
+    /// @brief Image height on a level.
+    [[nodiscard]] int level_height(int level) const;
+    /// @brief Number of tile columns on a level.
+    [[nodiscard]] int tiles_x(int level) const;
+    /// @brief Number of tile rows on a level.
+    [[nodiscard]] int tiles_y(int level) const;
+
+    /// @brief Get tile pixels.
+    /// @param level pyramid level.
+    /// @param x tile column.
+    /// @param y tile row.
+    /// @return tile_size * tile_size pixels in the mapped memory, nullptr if the tile does not exist.
+    [[nodiscard]] const Color::type* tile(int level, int x, int y) const;
+
+private:
+    struct Mapping;
+    explicit Pyramid(std::unique_ptr<Mapping>&& mapping);
+    std::unique_ptr<Mapping> m_map;
+};
+
+/// @brief Pan and zoom a Pyramid on a canvas.
+/// @details Only tiles visible on the current view are sent to the client. Level is picked from the zoom so that
+/// there is at least a level pixel per screen pixel. The client keeps the received tiles in a cache that is
+/// evicted in the least recently used order. Tiles next to the view along the pan direction are prefetched when
+/// the connection is idle. Tiles are sent only as fast as the connection drains them, and requests that are
+/// not visible anymore, e.g. during fast zoom, are cancelled before they are sent. While a tile is on its way
+/// a lower resolution tile already in the cache is drawn in its place.
+/// @code{.cpp}
+/// Gempyre::PyramidViewer viewer(canvas, Gempyre::Pyramid::open("image.pyr"), 1024, 768);
+/// canvas.subscribe("wheel", [&](const Gempyre::Event& ev) {
+///     const auto delta = GempyreUtils::parse<double>(ev.properties.at("deltaY"));
+///     viewer.zoom(delta && *delta > 0 ? 0.8 : 1.25, 512, 384);
+/// }, {"deltaY"});
+/// @endcode
+class GEMPYRE_EX PyramidViewer : public CanvasElement {
+public:
+    /// @brief Default number of tiles kept in the client cache.
+    static constexpr size_t DEFAULT_CACHE_TILES = 512;
+
+    /// @brief Constructor.
+    /// @param canvas canvas to draw on.
+    /// @param pyramid image to view.
+    /// @param width view width in canvas pixels.
+    /// @param height view height in canvas pixels.
+    /// @param cache_tiles number of tiles client keeps in cache.
+    PyramidViewer(const CanvasElement& canvas, const std::shared_ptr<const Pyramid>& pyramid, int width, int height, size_t cache_tiles = DEFAULT_CACHE_TILES);
+
+    /// Copy constructor - copy shares the view.
+    PyramidViewer(const PyramidViewer& other) = default;
+    /// Move constructor.
+    PyramidViewer(PyramidViewer&& other) = default;
+    /// Destructor.
+    ~PyramidViewer();
+
+    /// @brief Set view.
+    /// @param x image x coordinate at the view center.
+    /// @param y image y coordinate at the view center.
+    /// @param zoom canvas pixels per image pixel.
+    void set_view(double x, double y, double zoom);
+
+    /// @brief Move view.
+    /// @param dx horizontal movement in canvas pixels.
+    /// @param dy vertical movement in canvas pixels.
+    void pan(double dx, double dy);
+
+    /// @brief Zoom view.
+    /// @param factor zoom multiplier, greater than 1 zooms in.
+    /// @param canvas_x canvas x coordinate that stays in place.
+    /// @param canvas_y canvas y coordinate that stays in place.
+    void zoom(double factor, double canvas_x, double canvas_y);
+
+    /// @brief Zoom to show whole image.
+    void fit();
+
+    /// @brief Change view size.
+    /// @param width view width in canvas pixels.
+    /// @param height view height in canvas pixels.
+    void resize(int width, int height);
+
+    /// @brief Image x coordinate at the view center.
+    [[nodiscard]] double x() const;
+    /// @brief Image y coordinate at the view center.
+    [[nodiscard]] double y() const;
+    /// @brief Canvas pixels per image pixel.
+    [[nodiscard]] double zoom() const;
+    /// @brief Pyramid level used for the current zoom.
+    [[nodiscard]] int level() const;
+    /// @brief Number of tiles waiting to be sent.
+    [[nodiscard]] size_t pending() const;
+    /// @brief Number of tiles in the client cache.
+    [[nodiscard]] size_t cached() const;
+
+private:
+    struct View;
+    std::shared_ptr<View> m_view;
+};
+}
+
+#endif // GEMPYRE_PYRAMID_H
@@ -16,23 +16,245 @@ var sys_error = console.error;
 
 const event_notifiers = new Set(); // For non-JS nottifiers
 
+// MessagePack, used instead of JSON when server accepts it, see 'encoding'
+let packed = false;
+const text_encoder = new TextEncoder();
+const text_decoder = new TextDecoder();
+
+function msgpackEncode(value) {
+    let buffer = new Uint8Array(256);
+    let view = new DataView(buffer.buffer);
+    let pos = 0;
+    const reserve = (size) => {
+        if(pos + size <= buffer.length)
+            return;
+        const grown = new Uint8Array(Math.max(buffer.length * 2, pos + size));
+        grown.set(buffer);
+        buffer = grown;
+        view = new DataView(buffer.buffer);
+    };
+    const header = (size, fix, fixMax, c8, c16, c32) => {
+        reserve(size + 5);
+        if(size <= fixMax) {
+            buffer[pos++] = fix | size;
+        } else if(c8 && size < 0x100) {
+            buffer[pos++] = c8;
+            buffer[pos++] = size;
+        } else if(size < 0x10000) {
+            buffer[pos++] = c16;
+            view.setUint16(pos, size);
+            pos += 2;
+        } else {
+            buffer[pos++] = c32;
+            view.setUint32(pos, size);
+            pos += 4;
+        }
+    };
+    const write = (v) => {
+        if(v === null || v === undefined) {
+            reserve(1);
+            buffer[pos++] = 0xc0;
+        } else if(v === true || v === false) {
+            reserve(1);
+            buffer[pos++] = v ? 0xc3 : 0xc2;
+        } else if(typeof v === 'number') {
+            reserve(9);
+            if(Number.isInteger(v) && v >= 0 && v < 0x80) {
+                buffer[pos++] = v;
+            } else if(Number.isInteger(v) && v < 0 && v >= -32) {
+                buffer[pos++] = v & 0xff;
+            } else if(Number.isInteger(v) && v >= 0 && v <= 0xffffffff) {
+                buffer[pos++] = 0xce;
+                view.setUint32(pos, v);
+                pos += 4;
+            } else if(Number.isInteger(v) && v < 0 && v >= -0x80000000) {
+                buffer[pos++] = 0xd2;
+                view.setInt32(pos, v);
+                pos += 4;
+            } else {
+                buffer[pos++] = 0xcb;
+                view.setFloat64(pos, v);
+                pos += 8;
+            }
+        } else if(typeof v === 'string') {
+            const bytes = text_encoder.encode(v);
+            header(bytes.length, 0xa0, 31, 0xd9, 0xda, 0xdb);
+            reserve(bytes.length);
+            buffer.set(bytes, pos);
+            pos += bytes.length;
+        } else if(Array.isArray(v)) {
+            header(v.length, 0x90, 15, 0, 0xdc, 0xdd);
+            v.forEach(write);
+        } else if(typeof v === 'object') {
+            const keys = Object.keys(v).filter(k => v[k] !== undefined);
+            header(keys.length, 0x80, 15, 0, 0xde, 0xdf);
+            for(const k of keys) {
+                write(k);
+                write(v[k]);
+            }
+        } else {
+            write(String(v));
+        }
+    };
+    write(value);
+    return buffer.slice(0, pos);
+}
+
+function msgpackDecode(arrayBuffer) {
+    const bytes = new Uint8Array(arrayBuffer);
+    const view = new DataView(arrayBuffer);
+    let pos = 0;
+    const str = (len) => {
+        const s = text_decoder.decode(bytes.subarray(pos, pos + len));
+        pos += len;
+        return s;
+    };
+    const bin = (len) => {
+        const b = bytes.slice(pos, pos + len);
+        pos += len;
+        return b;
+    };
+    const array = (len) => {
+        const a = new Array(len);
+        for(let i = 0; i < len; i++)
+            a[i] = read();
+        return a;
+    };
+    const map = (len) => {
+        const m = {};
+        for(let i = 0; i < len; i++) {
+            const k = read();
+            m[k] = read();
+        }
+        return m;
+    };
+    const read = () => {
+        const c = bytes[pos++];
+        let v;
+        if(c < 0x80) return c;
+        if(c < 0x90) return map(c & 0x0f);
+        if(c < 0xa0) return array(c & 0x0f);
+        if(c < 0xc0) return str(c & 0x1f);
+        if(c >= 0xe0) return c - 0x100;
+        switch(c) {
+        case 0xc0: return null;
+        case 0xc2: return false;
+        case 0xc3: return true;
+        case 0xc4: return bin(bytes[pos++]);
+        case 0xc5: v = view.getUint16(pos); pos += 2; return bin(v);
+        case 0xc6: v = view.getUint32(pos); pos += 4; return bin(v);
+        case 0xca: v = view.getFloat32(pos); pos += 4; return v;
+        case 0xcb: v = view.getFloat64(pos); pos += 8; return v;
+        case 0xcc: return bytes[pos++];
+        case 0xcd: v = view.getUint16(pos); pos += 2; return v;
+        case 0xce: v = view.getUint32(pos); pos += 4; return v;
+        case 0xcf: v = Number(view.getBigUint64(pos)); pos += 8; return v;
+        case 0xd0: v = view.getInt8(pos); pos += 1; return v;
+        case 0xd1: v = view.getInt16(pos); pos += 2; return v;
+        case 0xd2: v = view.getInt32(pos); pos += 4; return v;
+        case 0xd3: v = Number(view.getBigInt64(pos)); pos += 8; return v;
+        case 0xd9: return str(bytes[pos++]);
+        case 0xda: v = view.getUint16(pos); pos += 2; return str(v);
+        case 0xdb: v = view.getUint32(pos); pos += 4; return str(v);
+        case 0xdc: v = view.getUint16(pos); pos += 2; return array(v);
+        case 0xdd: v = view.getUint32(pos); pos += 4; return array(v);
+        case 0xde: v = view.getUint16(pos); pos += 2; return map(v);
+        case 0xdf: v = view.getUint32(pos); pos += 4; return map(v);
+        default:
+            throw new Error("Unsupported MessagePack type " + c);
+        }
+    };
+    return read();
+}
+
+// Messages are maps, bitmaps start with a little endian uint32 type
+function isMsgpack(arrayBuffer) {
+    const c = new Uint8Array(arrayBuffer, 0, 1)[0];
+    return (c & 0xf0) === 0x80 || c === 0xde || c === 0xdf;
+}
+
+// Server accepts only limited size messages, larger are sent as binary 'GFRG' fragments:
+// magic, uint32 sequence, uint32 flags (FRAGMENT_LAST, FRAGMENT_PACKED) and the payload, all little endian
+const FRAGMENT_SIZE = 1024 * 1024;
+const FRAGMENT_HEADER = 12;
+const FRAGMENT_LAST = 0x1;
+const FRAGMENT_PACKED = 0x2;
+
+function sendFragments(bytes, flags) {
+    for(let seq = 0, pos = 0; pos < bytes.length; ++seq, pos += FRAGMENT_SIZE) {
+        const part = bytes.subarray(pos, pos + FRAGMENT_SIZE);
+        const fragment = new Uint8Array(FRAGMENT_HEADER + part.length);
+        const view = new DataView(fragment.buffer);
+        fragment.set([0x47, 0x46, 0x52, 0x47]); // GFRG
+        view.setUint32(4, seq, true);
+        view.setUint32(8, flags | (pos + FRAGMENT_SIZE >= bytes.length ? FRAGMENT_LAST : 0), true);
+        fragment.set(part, FRAGMENT_HEADER);
+        socket.send(fragment);
+    }
+}
+
+function sendMessage(msg) {
+    if(packed) {
+        const bytes = msgpackEncode(msg);
+        if(bytes.length > FRAGMENT_SIZE)
+            sendFragments(bytes, FRAGMENT_PACKED);
+        else
+            socket.send(bytes);
+        return;
+    }
+    const text = JSON.stringify(msg);
+    if(text.length * 3 > FRAGMENT_SIZE) { // UTF-8 is max 3 bytes per UTF-16 unit
+        const bytes = text_encoder.encode(text);
+        if(bytes.length > FRAGMENT_SIZE) {
+            sendFragments(bytes, 0);
+            return;
+        }
+    }
+    socket.send(text);
+}
+
 var last_msg_id = -1;
 
+// Server gives an element a numeric handle on its first message, later messages use only the handle
+const handles = new Map(); // handle -> {id, node}
+
+function resolveHandle(msg) {
+    if(msg.type === 'handles') { // handles assigned before this UI connected
+        for(const [id, handle] of msg.handles)
+            handles.set(handle, {id: id, node: null});
+    } else if(msg.handle !== undefined) {
+        handles.set(msg.handle, {id: msg.element, node: null});
+    } else if(typeof msg.element === 'number') {
+        const entry = handles.get(msg.element);
+        msg.handle = msg.element;
+        msg.element = entry ? entry.id : 'handle ' + msg.handle;
+    }
+}
+
+function handleNode(handle) {
+    const entry = handles.get(handle);
+    if(!entry)
+        return null;
+    if(!entry.node || !entry.node.isConnected) // element may have been recreated e.g. by a parent's innerHTML
+        entry.node = document.getElementById(entry.id);
+    return entry.node;
+}
+
 function g_log(msg) {
     const logged = Array.prototype.slice.call(arguments).join(', ');
-    socket.send(JSON.stringify({'type': 'log', 'level': 'log', 'msg': logged}));
+    sendMessage({'type': 'log', 'level': 'log', 'msg': logged});
     sys_log(msg);
 }
 
 function g_warn(msg) {
     const logged = Array.prototype.slice.call(arguments).join(', ');
-    socket.send(JSON.stringify({'type': 'log', 'level': 'warn', 'msg': logged}));
+    sendMessage({'type': 'log', 'level': 'warn', 'msg': logged});
     sys_warn(msg);
 }
 
 function g_info(msg) {
     const logged = Array.prototype.slice.call(arguments).join(', ');
-    socket.send(JSON.stringify({'type': 'log', 'level': 'info', 'msg': logged}));
+    sendMessage({'type': 'log', 'level': 'info', 'msg': logged});
     sys_info(msg);
 }
 
@@ -45,7 +267,7 @@ function g_error(msg) {
       return obj.stack;
     };
     const logged = Array.prototype.slice.call(arguments).join(', ');
-    socket.send(JSON.stringify({'type': 'log', 'level': 'error', 'msg': logged, 'trace': getTrace()}));
+    sendMessage({'type': 'log', 'level': 'error', 'msg': logged, 'trace': getTrace()});
     sys_error(msg);
 }
 
@@ -68,15 +290,15 @@ function errlog(source, text) {
     };
 
     console.error("error:" + source + " --> " + text);
-    socket.send(JSON.stringify({'type': 'error', 'element': String(source), 'error': text, 'trace': getTrace()}));
+    sendMessage({'type': 'error', 'element': String(source), 'error': text, 'trace': getTrace()});
 }
 
 function catchLog(error, extra) {
     source = error.name || "Unknown";
     console.error("error:" + source + " --> " + error.message + " \"" + (extra ? extra : '"'));
-    socket.send(JSON.stringify({'type': 'error',
+    sendMessage({'type': 'error',
         'element': String(source),
-        'error': error.message + " \"" + (extra ? extra : '"'), 'trace': error.stack}));
+        'error': error.message + " \"" + (extra ? extra : '"'), 'trace': error.stack});
 }
 
 function assert(condition, msg) {
@@ -138,8 +360,229 @@ function throttled(delay, fn) {
   }
 }
 
-function addEvent(el, source, eventname, properties, throttle) {
-    handler = (event) => {
+// last call of a burst is made when delay has passed since the previous call
+function throttledTrailing(delay, fn) {
+    let lastCall = null;
+    let trailing = null;
+    return function (...args) {
+        const now = (new Date).getTime();
+        if(lastCall && now - lastCall < delay) {
+            if(trailing)
+                clearTimeout(trailing);
+            trailing = setTimeout(function() {
+                trailing = null;
+                lastCall = (new Date).getTime();
+                fn(...args);
+            }, delay - (now - lastCall));
+            return;
+        }
+        if(trailing) {
+            clearTimeout(trailing);
+            trailing = null;
+        }
+        lastCall = now;
+        return fn(...args);
+    }
+}
+
+// call is made when no other has followed within the delay
+function debounced(delay, fn) {
+    let timer = null;
+    return function (...args) {
+        if(timer)
+            clearTimeout(timer);
+        timer = setTimeout(function() {
+            timer = null;
+            fn(...args);
+        }, delay);
+    }
+}
+
+// Calls fn on the next animation frame, or after a while if there is none, as a hidden page gets no frames
+function onNextFrame(fn) {
+    let timer = null;
+    const frame = requestAnimationFrame(() => {
+        clearTimeout(timer);
+        fn();
+    });
+    timer = setTimeout(() => {
+        cancelAnimationFrame(frame);
+        fn();
+    }, 100);
+}
+
+// events of Delivery::Frame subscriptions, sent together once per frame
+let frame_events = [];
+
+function sendFrameEvent(event) {
+    frame_events.push(event);
+    if(frame_events.length > 1)
+        return;
+    const flush = function() {
+        const events = frame_events;
+        frame_events = [];
+        if(socket.readyState === 1)
+            sendMessage({'type': 'events', 'events': events});
+    };
+    onNextFrame(flush);
+}
+
+// pointer samples of each element are sent once per frame as binary, see Element::subscribe_pointer:
+// little endian uint32 0xB01, sample count, id length, id padded to four bytes and 32 byte samples
+const POINTER_STREAM_ID = 0xB01;
+const POINTER_SAMPLE_SIZE = 32;
+const POINTER_KINDS = {'pointerdown': 0, 'pointermove': 1, 'pointerup': 2, 'pointercancel': 2};
+// node -> samples waiting the frame, a removed node and its listeners go with it, a recreated one is streamed anew
+const pointer_streams = new WeakMap();
+
+function addPointerStream(el, source) {
+    if(pointer_streams.has(el))
+        return;
+    const stream = {'samples': [], 'rect': null};
+    pointer_streams.set(el, stream);
+    const flush = function() {
+        const samples = stream.samples;
+        stream.samples = [];
+        stream.rect = null;
+        if(socket.readyState === 1 && el.isConnected)
+            sendPointers(source, samples);
+    };
+    const listener = function(event) {
+        if(!stream.rect)
+            stream.rect = el.getBoundingClientRect();
+        const kind = POINTER_KINDS[event.type];
+        const events = event.type === 'pointermove' && event.getCoalescedEvents ? event.getCoalescedEvents() : [];
+        if(stream.samples.length === 0)
+            onNextFrame(flush);
+        for(const e of (events.length > 0 ? events : [event])) {
+            stream.samples.push([e.timeStamp, e.clientX - stream.rect.left, e.clientY - stream.rect.top,
+                e.pressure, e.buttons, e.pointerId, kind]);
+        }
+    };
+    for(const name of Object.keys(POINTER_KINDS))
+        el.addEventListener(name, listener);
+}
+
+function sendPointers(source, samples) {
+    const id = text_encoder.encode(source);
+    const idSize = (id.length + 3) & ~3;
+    const buffer = new ArrayBuffer(12 + idSize + samples.length * POINTER_SAMPLE_SIZE);
+    const view = new DataView(buffer);
+    view.setUint32(0, POINTER_STREAM_ID, true);
+    view.setUint32(4, samples.length, true);
+    view.setUint32(8, id.length, true);
+    new Uint8Array(buffer, 12, id.length).set(id);
+    let pos = 12 + idSize;
+    for(const [timestamp, x, y, pressure, buttons, pointerId, kind] of samples) {
+        view.setFloat64(pos, timestamp, true);
+        view.setFloat32(pos + 8, x, true);
+        view.setFloat32(pos + 12, y, true);
+        view.setFloat32(pos + 16, pressure, true);
+        view.setUint32(pos + 20, buttons, true);
+        view.setUint32(pos + 24, pointerId, true);
+        view.setUint32(pos + 28, kind, true);
+        pos += POINTER_SAMPLE_SIZE;
+    }
+    socket.send(buffer);
+}
+
+function eventValue(event, key) {
+    if(key in event)
+        return event[key];
+    if(event.currentTarget && key in event.currentTarget)
+        return event.currentTarget[key];
+    if(event.target && key in event.target)
+        return event.target[key];
+    return undefined;
+}
+
+// see Gempyre::EventFilter
+function eventFilter(filter, value) {
+    switch(filter.op) {
+        case 'equals':
+            return String(value) === filter.values[0];
+        case 'one_of':
+            return filter.values.includes(String(value));
+        case 'range':
+            return Number(value) >= filter.min && Number(value) <= filter.max;
+        case 'magnitude':
+            return Math.abs(Number(value)) >= filter.min;
+        default:
+            errlog(filter.op, "Unknown filter");
+            return true;
+    }
+}
+
+// see Element::Action
+function runAction(el, action) {
+    const target = action.target.length > 0 ? document.getElementById(action.target) : el;
+    if(!target) {
+        errlog(action.target, 'not found for action', action.op);
+        return;
+    }
+    switch(action.op) {
+        case 'set_style':
+            target.style[action.name] = action.value;
+            break;
+        case 'remove_style':
+            target.style.removeProperty(action.name);
+            break;
+        case 'add_class':
+            target.classList.add(action.name);
+            break;
+        case 'remove_class':
+            target.classList.remove(action.name);
+            break;
+        case 'toggle_class':
+            target.classList.toggle(action.name);
+            break;
+        case 'set_attribute':
+            setAttribute(target, action.name, action.value);
+            break;
+        case 'remove_attribute':
+            target.removeAttribute(action.name);
+            break;
+        case 'show':
+            target.hidden = false;
+            break;
+        case 'hide':
+            target.hidden = true;
+            break;
+        case 'toggle_hidden':
+            target.hidden = !target.hidden;
+            break;
+        case 'focus':
+            target.focus();
+            break;
+        default:
+            errlog(action.op, "Unknown action");
+    }
+}
+
+// actions run here, server gets an 'action:' prefixed event afterwards if it asked, see Element::bind
+function addActions(el, source, eventname, actions, notify, filters) {
+    const listener = function(event) {
+        if(filters && !filters.every(f => eventFilter(f, eventValue(event, f.property))))
+            return;
+        for(const action of actions)
+            runAction(el, action);
+        if(notify && socket.readyState === 1)
+            sendMessage({'type': 'event', 'element': source, 'event': 'action:' + eventname, 'properties': {}});
+    };
+    if(eventname === 'resize')
+        window.addEventListener(eventname, listener);
+    else
+        el.addEventListener(eventname, listener);
+}
+
+function addEvent(el, source, eventname, properties, throttle, delivery, filters) {
+    const sendEvent = (values) => {
+        if(delivery === 'frame')
+            sendFrameEvent({'element': source, 'event': eventname, 'properties':values});
+        else
+            sendMessage({'type': 'event',  'element': source, 'event': eventname, 'properties':values});
+    };
+    const handler = (event) => {
 
         if(socket.readyState !== 1)
             return;
@@ -150,26 +593,27 @@ function addEvent(el, source, eventname, properties, throttle) {
             }
         }
 
+        if(filters && !filters.every(f => eventFilter(f, eventValue(event, f.property))))
+            return;
+
         event.stopPropagation();
 
         const values = {};
         for(const key of properties) {
-            if(key in event) {
-                values[key] = event[key];
-            }
-            else if(event.currentTarget && key in event.currentTarget) {
-                values[key] = event.currentTarget[key];
-            }
-            else if(event.target && key in event.target) {
-                values[key] = event.target[key];
-            }
+            const value = eventValue(event, key);
+            if(value !== undefined)
+                values[key] = value;
         }
 
         log("do event", el, source, eventname, values, event);
-        socket.send(JSON.stringify({'type': 'event',  'element': source, 'event': eventname, 'properties':values}));
+        send(values);
     };
 
-    const usedHandler = throttle && throttle > 0 ? throttled(throttle, handler) : handler;
+    // values are read when event is dispatched, a deferred send would not see its target anymore
+    const delay = delivery !== 'frame' && throttle ? parseInt(throttle) : 0;
+    const send = delay > 0 && delivery === 'throttle_trailing' ? throttledTrailing(delay, sendEvent) :
+        delay > 0 && delivery === 'debounce' ? debounced(delay, sendEvent) : sendEvent;
+    const usedHandler = delay > 0 && send === sendEvent ? throttled(delay, handler) : handler;
     if(eventname === 'resize') { //Only window supports the resize event
         log("addEventing", "window", source, eventname, throttle);
         window.addEventListener(eventname, usedHandler);
@@ -185,11 +629,11 @@ function addEvent(el, source, eventname, properties, throttle) {
                 setTimeout(on_complete, 500);
             } else {
                 log("Element ", el.id, "is ready...send", el.complete, el.width, el.height);
-                socket.send(JSON.stringify({'type': 'event',  'element': el.id, 'event': 'load', 'properties': {
+                sendMessage({'type': 'event',  'element': el.id, 'event': 'load', 'properties': {
                     'complete': el.complete,
                     'width': el.width,
                     'height': el.height
-                }}));
+                }});
             }
         };
         if (el.complete) {
@@ -218,7 +662,7 @@ function sendGempyreEvent(source, eventname, values) {
         return false;
     }
     log("do Gempyre event", source, eventname, values);
-    socket.send(JSON.stringify({'type': 'event',  'element': source, 'event': eventname, 'properties':values}));
+    sendMessage({'type': 'event',  'element': source, 'event': eventname, 'properties':values});
     return true;
 }
 
@@ -236,7 +680,7 @@ function serveQuery(element, query_id, query, query_params) {
     const el = element.length > 0 ? document.getElementById(element) : document.body;
     if(!el) {
         errlog(element, 'not found:', element, '" for query"');
-        socket.send(JSON.stringify({'type': 'query', 'query_id': query_id, 'query_value':'query_error', 'query_error':'query_error'}));
+        sendMessage({'type': 'query', 'query_id': query_id, 'query_value':'query_error', 'query_error':'query_error'});
         return;
     }
     log("query", el, query_id, query);
@@ -245,7 +689,7 @@ function serveQuery(element, query_id, query, query_params) {
             const attributes = new Object();
             for(const a of el.attributes) //attributes is NamedNodeMap not on list of pairs
                 attributes[a.name] = a.value;
-            socket.send(JSON.stringify({'type': 'query', 'query_id': query_id, 'query_value': 'attributes', 'attributes': attributes}));
+            sendMessage({'type': 'query', 'query_id': query_id, 'query_value': 'attributes', 'attributes': attributes});
             break;
          case 'children':
             const children = [];
@@ -253,25 +697,25 @@ function serveQuery(element, query_id, query, query_params) {
                 if(c.nodeType === 1) //only elements
                     children.push(id(c));  //just ids
             }
-            socket.send(JSON.stringify({'type': 'query', 'query_id': query_id, 'query_value': 'children', 'children': children}));
+            sendMessage({'type': 'query', 'query_id': query_id, 'query_value': 'children', 'children': children});
             break;
         case 'parent':
             // ids are not allowed to have spaces, so we use that abonomination for a root :-D
             let parentValue = (
                 el.parentNode == document.body ||
                 el.parentElement == document.body) ? ": :" : el.parentElement.id;
-            socket.send(JSON.stringify({
+            sendMessage({
                 'type': 'query',
                 'query_id': query_id,
                 'query_value': 'parent',
-                'parent': parentValue})); 
+                'parent': parentValue}); 
             break;    
         case 'value':
-            socket.send(JSON.stringify({
+            sendMessage({
                 'type': 'query',
                 'query_id': query_id,
                 'query_value': 'value',
-                'value': {value: el.value, checked: el.checked, 'name': el.name, 'named':el[el.name]}}));
+                'value': {value: el.value, checked: el.checked, 'name': el.name, 'named':el[el.name]}});
             break;
         case 'styles':
             const styles = new Object();
@@ -280,52 +724,205 @@ function serveQuery(element, query_id, query, query_params) {
                 styles[s] = computedStyles[s]
             //    if(s in computedStyles)
             //    styles[s.name] = s.value;
-            socket.send(JSON.stringify({
+            sendMessage({
                 'type': 'query',
                 'query_id': query_id,
                 'query_value': 'styles',
                 'styles': styles
               //  'styles': {'obj':'styles', 'type': typeof(computedStyles), 'sz':Object.keys(computedStyles)}
-                                       }));
+                                       });
             break
         case 'innerHTML':
-             socket.send(JSON.stringify({
+             sendMessage({
                 'type': 'query',
                 'query_id': query_id,
                 'query_value': 'innerHTML',
-                'innerHTML': el.innerHTML}));
+                'innerHTML': el.innerHTML});
             break;
         case 'element_type':
-            socket.send(JSON.stringify({
+            sendMessage({
                'type': 'query',
                'query_id': query_id,
                'query_value': 'element_type',
-               'element_type': el.nodeName.toLowerCase()}));
+               'element_type': el.nodeName.toLowerCase()});
            break;
         case 'bounding_rect':
             const r = el.getBoundingClientRect();
            // const r = (el != document.root) ? el.getBoundingClientRect() : function() {
            //     return {'left':0,'top':0,'right': window.outterWidth,'bottom': window.outterHeight + 400};
            // }();
-            socket.send(JSON.stringify({
+            sendMessage({
                'type': 'query',
                'query_id': query_id,
                'query_value': 'bounding_rect',
-               'bounding_rect': {'x':r.left, 'y':r.top, 'width': r.right - r.left, 'height': r.bottom - r.top}}));
+               'bounding_rect': {'x':r.left, 'y':r.top, 'width': r.right - r.left, 'height': r.bottom - r.top}});
            break;
+        case 'snapshot':
+            sendMessage({
+               'type': 'query',
+               'query_id': query_id,
+               'query_value': 'snapshot',
+               'snapshot': snapshotNode(el, query_params.attributes, query_params.depth)});
+            break;
+        case 'properties':
+            sendMessage({
+               'type': 'query',
+               'query_id': query_id,
+               'query_value': 'properties',
+               'properties': queryProperties(query_params)});
+            break;
         case 'devicePixelRatio':
-            socket.send(JSON.stringify({
+            sendMessage({
                                            'type': 'query',
                                            'query_id': query_id,
                                            'query_value': 'devicePixelRatio',
                                            'devicePixelRatio': window.devicePixelRatio
-                                       }));
+                                       });
             break;
         default:
             errlog(query_id, "Unknown query " + query);
     }
 }
 
+// value of a property, see Ui::properties, cache keeps the rect and computed style of el
+function readProperty(el, p, cache) {
+    let v = undefined;
+    switch(p) {
+        case 'x':
+        case 'y':
+        case 'width':
+        case 'height':
+            if(!cache.rect)
+                cache.rect = el.getBoundingClientRect();
+            v = p === 'x' ? cache.rect.left : p === 'y' ? cache.rect.top : cache.rect[p];
+            break;
+        case 'value':
+        case 'checked':
+        case 'name':
+        case 'innerHTML':
+            v = el[p];
+            break;
+        case 'type':
+            v = el.nodeName.toLowerCase();
+            break;
+        default:
+            if(p.startsWith('attribute:')) {
+                v = el.getAttribute(p.substring(10));
+            } else if(p.startsWith('style:')) {
+                if(!cache.styles)
+                    cache.styles = window.getComputedStyle(el);
+                v = cache.styles.getPropertyValue(p.substring(6));
+            } else {
+                errlog(p, "Unknown property");
+            }
+    }
+    return v === undefined || v === null ? '' : v;
+}
+
+// rows of [id, values...]
+function queryProperties(params) {
+    let elements = [];
+    if(params.selector !== undefined) {
+        try {
+            elements = document.querySelectorAll(params.selector);
+        } catch(e) {
+            errlog(params.selector, 'invalid selector', e);
+        }
+    } else {
+        for(const i of params.elements) {
+            const el = document.getElementById(i);
+            if(el)
+                elements.push(el);
+        }
+    }
+    const rows = [];
+    for(const el of elements) {
+        const cache = {};
+        const row = [id(el)];
+        for(const p of params.properties)
+            row.push(readProperty(el, p, cache));
+        rows.push(row);
+    }
+    return rows;
+}
+
+// [type, id, [attribute values], text, [children]], see Element::snapshot. Ids are not generated here.
+function snapshotNode(el, attributes, depth) {
+    let text = '';
+    for(const c of el.childNodes) {
+        if(c.nodeType === 3) // text
+            text += c.nodeValue;
+    }
+    const children = [];
+    if(depth > 0) {
+        for(const c of el.children)
+            children.push(snapshotNode(c, attributes, depth - 1));
+    }
+    return [el.nodeName.toLowerCase(), el.id, attributes.map(a => el.getAttribute(a)), text.trim(), children];
+}
+
+const mirrors = new Map(); // element id -> mirrored properties, see Element::mirror
+
+function setMirror(el, element, properties) {
+    const old = mirrors.get(element);
+    const seq = old ? old.seq : 0;
+    if(old) {
+        old.observer.disconnect();
+        el.removeEventListener('input', old.listener);
+        el.removeEventListener('change', old.listener);
+        mirrors.delete(element);
+    }
+    if(properties.length === 0)
+        return;
+    const mirror = {'properties': properties, 'pending': false, 'seq': seq};
+    // changes are coalesced into a single push
+    mirror.listener = function() {
+        if(mirror.pending)
+            return;
+        mirror.pending = true;
+        setTimeout(function() {
+            mirror.pending = false;
+            if(mirrors.get(element) === mirror)
+                pushMirror(element, mirror);
+        }, 0);
+    };
+    const options = {};
+    if(properties.includes('innerHTML')) {
+        options.childList = true;
+        options.subtree = true;
+        options.characterData = true;
+        options.attributes = true;
+    } else {
+        const attributes = properties.filter(p => p.startsWith('attribute:')).map(p => p.substring(10));
+        if(properties.includes('value') || properties.includes('checked'))
+            attributes.push('value', 'checked');
+        if(attributes.length > 0) {
+            options.attributes = true;
+            options.attributeFilter = attributes;
+        }
+    }
+    mirror.observer = new MutationObserver(mirror.listener);
+    if(Object.keys(options).length > 0)
+        mirror.observer.observe(el, options);
+    if(properties.includes('value') || properties.includes('checked')) {
+        el.addEventListener('input', mirror.listener);
+        el.addEventListener('change', mirror.listener);
+    }
+    mirrors.set(element, mirror);
+    pushMirror(element, mirror);
+}
+
+function pushMirror(element, mirror) {
+    const el = document.getElementById(element);
+    if(!el)
+        return;
+    const cache = {};
+    const values = {};
+    for(const p of mirror.properties)
+        values[p] = readProperty(el, p, cache);
+    sendMessage({'type': 'mirror', 'element': element, 'values': values, 'seq': mirror.seq});
+}
+
 function sendCollection(name, query_id, query, collectionFunction) {
     const children = [];
     const collection = collectionFunction(name);
@@ -333,7 +930,112 @@ function sendCollection(name, query_id, query, collectionFunction) {
         if(c.nodeType === 1)
             children.push(id(c)); 
     }
-    socket.send(JSON.stringify({'type': 'query', 'query_id': query_id, 'query_value': 'children', 'children': children}));   
+    sendMessage({'type': 'query', 'query_id': query_id, 'query_value': 'children', 'children': children});   
+}
+
+var scale_canvas = null; // scratch canvas for scaled tiles
+
+function putScaledImage(ctx, buffer, offset, x, y, w, h, scale, rgb565) {
+    const sw = Math.ceil(w / scale);
+    const sh = Math.ceil(h / scale);
+    let pixels = null;
+    if(rgb565) {
+        const src = new Uint16Array(buffer, offset, sw * sh);
+        pixels = new Uint8ClampedArray(sw * sh * 4);
+        for(let i = 0; i < src.length; i++) {
+            const v = src[i];
+            const r = (v >> 11) & 0x1F;
+            const g = (v >> 5) & 0x3F;
+            const b = v & 0x1F;
+            pixels[i * 4] = (r << 3) | (r >> 2);
+            pixels[i * 4 + 1] = (g << 2) | (g >> 4);
+            pixels[i * 4 + 2] = (b << 3) | (b >> 2);
+            pixels[i * 4 + 3] = 0xFF;
+        }
+    } else {
+        pixels = new Uint8ClampedArray(buffer, offset, sw * sh * 4);
+    }
+    const imageData = new ImageData(pixels, sw, sh);
+    if(scale === 1) {
+        ctx.putImageData(imageData, x, y);
+        return;
+    }
+    if(!scale_canvas)
+        scale_canvas = document.createElement('canvas');
+    if(scale_canvas.width < sw || scale_canvas.height < sh) {
+        scale_canvas.width = Math.max(scale_canvas.width, sw);
+        scale_canvas.height = Math.max(scale_canvas.height, sh);
+    }
+    scale_canvas.getContext('2d').putImageData(imageData, 0, 0);
+    ctx.drawImage(scale_canvas, 0, 0, w / scale, h / scale, x, y, w, h);
+}
+
+const staged_layers = new Map(); // layers container id -> draws waiting a commit
+
+function setCanvasLayers(el) {
+    let first = true;
+    for(const c of el.children) {
+        if(c.nodeName.toLowerCase() === 'canvas') {
+            c.getContext("2d", {alpha: !first}); // context attributes are set on first call
+            first = false;
+        }
+    }
+}
+
+const tile_cache = new Map();   // pyramid tile key -> canvas holding the tile
+const tile_evicted = new Set(); // keys evicted before their tile arrived
+const tile_draws = new Map();   // canvas -> its last tile draw
+
+function drawTiles(el, tiles) {
+    const ctx = el.getContext("2d");
+    ctx.clearRect(0, 0, el.width, el.height);
+    for(const t of tiles) { // [key, sx, sy, sw, sh, dx, dy, dw, dh], rounded to avoid seams
+        const tile = tile_cache.get(t[0]);
+        if(tile) {
+            const x = Math.round(t[5]);
+            const y = Math.round(t[6]);
+            ctx.drawImage(tile, t[1], t[2], t[3], t[4], x, y, Math.round(t[5] + t[7]) - x, Math.round(t[6] + t[8]) - y);
+        }
+    }
+}
+
+function tileDraw(el, tiles, evict) {
+    if(evict) {
+        for(const key of evict) {
+            if(!tile_cache.delete(key))
+                tile_evicted.add(key); // still on its way
+        }
+    }
+    if(tiles) {
+        tile_draws.set(el, {tiles: tiles, pending: false});
+        drawTiles(el, tiles);
+    }
+}
+
+function storeTile(key, data, w, h) {
+    if(tile_evicted.delete(key))
+        return;
+    const tile = document.createElement('canvas');
+    tile.width = w;
+    tile.height = h;
+    const bytesLen = w * h * 4;
+    tile.getContext('2d').putImageData(new ImageData(data.length === bytesLen ? data : data.slice(0, bytesLen), w, h), 0, 0);
+    tile_cache.set(key, tile);
+    // redraw views waiting this tile, once per frame
+    for(const [el, draw] of tile_draws) {
+        if(!el.isConnected) {
+            tile_draws.delete(el);
+        } else if(!draw.pending && draw.tiles.some(t => t[0] === key)) {
+            draw.pending = true;
+            requestAnimationFrame(() => {
+                const current = tile_draws.get(el);
+                if(current) {
+                    current.pending = false;
+                    drawTiles(el, current.tiles);
+                }
+            });
+        }
+    }
 }
 
 function handleBinary(buffer) {
@@ -343,7 +1045,7 @@ function handleBinary(buffer) {
         return;
     }
     const type = bytes[0];
-    if(type === 0xAAA) {
+    if(type === 0xAAA || type === 0xAAB) { // 0xAAB has a handle instead of the id
         const datalen = bytes[1] * 4;
         const idLen = bytes[2];
         const headerLen = bytes[3];
@@ -354,37 +1056,72 @@ function handleBinary(buffer) {
         const y = bytes[headerOffset + 1];
         const w = bytes[headerOffset + 2];
         const h = bytes[headerOffset + 3];
-        const as_draw = bytes[headerOffset + 4];
+        const flags = bytes[headerOffset + 4];
+        const as_draw = flags & 0x1;
+        const scale = (flags >> 8) & 0xFF;      // tile is sent smaller and has to be scaled up
+        const rgb565 = (flags & 0x10000) != 0;  // two bytes per pixel
+        const staged = (flags & 0x1000000) != 0; // layer tile, drawn on commit
+        const commit = (flags & 0x2000000) != 0; // commit layers, id is the layers container
+        const cached = (flags & 0x4000000) != 0; // pyramid tile, id is the tile cache key
         const idOffset = (5 * 4) + dataOffset + datalen;
-        const words = new Uint16Array(buffer, idOffset, idLen);
+        const handle = type === 0xAAB ? new Uint32Array(buffer, idOffset, 1)[0] : undefined;
         let id = "";
-        for(let i = 0 ; i < words.length && words[i] > 0; i++)
-            id += String.fromCharCode(words[i]);
-        const element = document.getElementById(id);
+        if(handle !== undefined) {
+            const entry = handles.get(handle);
+            id = entry ? entry.id : 'handle ' + handle;
+        } else {
+            const words = new Uint16Array(buffer, idOffset, idLen);
+            for(let i = 0 ; i < words.length && words[i] > 0; i++)
+                id += String.fromCharCode(words[i]);
+        }
+
+        if(cached) {
+            storeTile(id, data, w, h);
+            return;
+        }
+
+        const element = handle !== undefined ? handleNode(handle) : document.getElementById(id);
 
         if(!element) {
             errlog(id, "Canvas not found '" + id + "'" + " at: ", idOffset, " len: ", idLen);
             return;
         }
 
-        if (datalen > 0) { // otherwise this is just a tail
+        if(commit) { // show all staged layer tiles at once
+            const staged = staged_layers.get(id);
+            staged_layers.delete(id);
+            if(staged)
+                staged.forEach(draw => draw());
+        } else if (datalen > 0) { // otherwise this is just a tail
             const ctx = element.getContext("2d", {alpha:false});
             if(ctx) {
-                if(w > 0 && h > 0) {
-                    const bytesLen = w * h * 4;
-                    const imageData = data.length === bytesLen ? new ImageData(data, w, h) : new ImageData(data.slice(0, bytesLen), w, h);
-                    ctx.putImageData(imageData, x, y);
+                const draw = () => {
+                    if(w > 0 && h > 0 && (scale > 1 || rgb565)) {
+                        putScaledImage(ctx, buffer, dataOffset, x, y, w, h, Math.max(1, scale), rgb565);
+                    } else if(w > 0 && h > 0) {
+                        const bytesLen = w * h * 4;
+                        const imageData = data.length === bytesLen ? new ImageData(data, w, h) : new ImageData(data.slice(0, bytesLen), w, h);
+                        ctx.putImageData(imageData, x, y);
+                    }
+                };
+                if(staged) {
+                    const layers = element.parentElement.id;
+                    if(!staged_layers.has(layers))
+                        staged_layers.set(layers, []);
+                    staged_layers.get(layers).push(draw);
+                } else {
+                    draw();
                 }
             } else {
                 errlog(id, "has no graphics context");
                 return;
             }
-        }    
+        }
 
 
         // if as_draw AND there is a notification request - send a notify
         if ((as_draw != 0) && event_notifiers.has("canvas_draw")) {
-            socket.send(JSON.stringify({
+            sendMessage({
                                             'type': 'event',
                                             'element': id,
                                             'event': 'event_notify',
@@ -392,7 +1129,7 @@ function handleBinary(buffer) {
                                                 'name': "canvas_draw",
                                                 'msgid': 0
                                             }
-                                        }));
+                                        });
             
         }
 
@@ -428,6 +1165,63 @@ function paintImage(element, imageName, pos, rect, clip) {
     }
 }
 
+const canvas_scales = new Map(); // canvas -> release function of its render scale observers
+
+function setCanvasScale(el, scale, smoothing) {
+    const release = canvas_scales.get(el);
+    if(release)
+        release();
+    const nearest = smoothing === 'nearest';
+    el.style.imageRendering = nearest ? 'pixelated' : 'auto';
+    const r = el.getBoundingClientRect();
+    if(!el.style.width && !el.style.height && Math.round(r.width) === el.width && Math.round(r.height) === el.height) {
+        // size looks to come from the backing store, pin it or resizes would feed themselves
+        el.style.width = r.width + 'px';
+        el.style.height = r.height + 'px';
+    }
+    let cssWidth = 0;   // ResizeObserver notifies the initial size
+    let cssHeight = 0;
+    let reported = null;
+    const update = () => {
+        const dpr = window.devicePixelRatio;
+        const s = scale > 0 ? scale : dpr;
+        const width = Math.max(1, Math.round(cssWidth * s));
+        const height = Math.max(1, Math.round(cssHeight * s));
+        if(width !== el.width || height !== el.height) {
+            el.width = width;   // clears the canvas and its context state
+            el.height = height;
+        }
+        const ctx = el.getContext("2d");
+        if(ctx)
+            ctx.imageSmoothingEnabled = !nearest;
+        if(!reported || reported.width !== width || reported.height !== height || reported.dpr !== dpr) {
+            reported = {'width': width, 'height': height, 'dpr': dpr};
+            sendGempyreEvent(id(el), 'canvas_resize', reported);
+        }
+    };
+    const observer = new ResizeObserver(entries => {
+        const rect = entries[entries.length - 1].contentRect;
+        cssWidth = rect.width;
+        cssHeight = rect.height;
+        update();
+    });
+    let media = null;
+    const onDpr = () => {
+        update();
+        watchDpr();
+    };
+    const watchDpr = () => {
+        media = window.matchMedia('(resolution: ' + window.devicePixelRatio + 'dppx)');
+        media.addEventListener('change', onDpr, {once: true});
+    };
+    observer.observe(el);
+    watchDpr();
+    canvas_scales.set(el, () => {
+        observer.disconnect();
+        media.removeEventListener('change', onDpr);
+    });
+}
+
 function canvasDraw(element, commands) {
     const ctx = element.getContext("2d");
     if(!ctx) {
@@ -569,22 +1363,83 @@ function canvasDraw(element, commands) {
     }
 }
 
-function httpGetBin(msg) {
-    const pull_id = msg['id'];
-    fetch(httpUrl  + '/data/' + pull_id)
-    .then(response => response.arrayBuffer())
-    .then(arrayBuffer => handleBinary(arrayBuffer))
+// Large payloads are fetched over HTTP. A message waits only for the earlier pulls and waiting messages of its
+// element, a message that is not for an element, or a pull without a target, waits for everything received before
+// it and holds everything after it. Only bitmap pulls have a target, others may change the document.
+const incoming = []; // {key, ready, handle}, key is an element handle or id, null if not for an element
+
+function receive(key, handle) {
+    incoming.push({key: key, ready: true, handle: handle});
+    handleIncoming();
 }
 
-function httpGetJson(msg) {
-    const pull_id = msg['id'];
-    fetch(httpUrl + '/data/' + pull_id)
-    .then(response => response.json())
-    .then(json => handleJson(json))
+function handleIncoming() {
+    const waiting = new Set();
+    let barrier = false;
+    for(let i = 0; i < incoming.length;) {
+        const entry = incoming[i];
+        const blocked = barrier || (entry.key === null ? i > 0 : waiting.has(entry.key));
+        if(entry.ready && !blocked) {
+            incoming.splice(i, 1);
+            try {
+                entry.handle();
+            } catch(error) {
+                catchLog(error, entry);
+            }
+        } else {
+            if(entry.key === null)
+                barrier = true;
+            else
+                waiting.add(entry.key);
+            ++i;
+        }
+    }
+}
+
+function jsonKey(msg) {
+    if(msg.type === 'batch' || msg.element === undefined || msg.element === '')
+        return null;
+    return msg.handle !== undefined ? msg.handle : msg.element; // handle is either given or in place of the id
+}
+
+function binaryKey(buffer) {
+    const bytes = new Uint32Array(buffer, 0, Math.min(4, buffer.byteLength >> 2));
+    if(bytes.length < 4 || bytes[0] !== 0xAAB)
+        return null;
+    const idOffset = 4 + bytes[1] + bytes[3]; // fixed header, data and header words, see handleBinary
+    return (idOffset + 1) * 4 <= buffer.byteLength ? new Uint32Array(buffer, idOffset * 4, 1)[0] : null;
+}
+
+function receiveJson(msg) {
+    if(msg.type === 'pull_binary' || msg.type === 'pull_json') {
+        httpPull(msg, msg.type === 'pull_binary' ? handleBinary : arrayBuffer => handleJson(isMsgpack(arrayBuffer) ?
+            msgpackDecode(arrayBuffer) : JSON.parse(text_decoder.decode(arrayBuffer))));
+        return;
+    }
+    receive(jsonKey(msg), () => handleJson(msg));
+}
+
+function httpPull(msg, handler) {
+    const entry = {key: msg.target !== undefined ? msg.target : null, ready: false, handle: () => {}};
+    incoming.push(entry);
+    fetch(httpUrl + '/data/' + msg.id, {cache: 'no-store'})
+    .then(response => {
+        if(!response.ok)
+            throw new Error("pull " + msg.id + " failed: " + response.status);
+        return response.arrayBuffer();
+    })
+    .then(arrayBuffer => {entry.handle = () => handler(arrayBuffer);})
+    .catch(error => errlog("Pull", error))
+    .finally(() => {
+        entry.ready = true;
+        handleIncoming();
+    });
 }
 
 function handleJson(msg) {
 
+    resolveHandle(msg);
+
     if('msgid' in msg) {
         msgid = parseInt(msg.msgid);
         if(msgid <= last_msg_id)
@@ -594,15 +1449,22 @@ function handleJson(msg) {
 
     handleJsonCommand(msg);
 
+    // the next push tells the latest write applied to the mirrored values
+    if(msg.mirror_seq !== undefined) {
+        const mirror = mirrors.get(msg.element);
+        if(mirror)
+            mirror.seq = msg.mirror_seq;
+    }
+
     if(event_notifiers.has(msg.type)) {
-        socket.send(JSON.stringify({
+        sendMessage({
                                        'type': 'event',
                                        'element': msg.element.length ? msg.element : "",
                                        'event': 'event_notify',
                                        'properties':{
                                            'name': msg.type,
                                            'msgid': 'msgid' in msg ? msg.msgid : 0
-                                       }}));
+                                       }});
     }
 }
 
@@ -644,9 +1506,13 @@ function handleJsonCommand(msg) {
         case 'extension':
             return;
         case 'nil':
+        case 'handles':
+            return;
+        case 'encoding':
+            packed = msg.encoding === 'msgpack';
             return;
         case 'exit_request':
-            socket.send(JSON.stringify({'type': 'exit_request'}));
+            sendMessage({'type': 'exit_request'});
             log("Bye bye");
             socket.close();
             return;
@@ -694,7 +1560,7 @@ function handleJsonCommand(msg) {
         case 'query':
             switch(msg.query) {
             case 'exists':
-                socket.send(JSON.stringify({'type': 'query', 'query_id': msg.query_id, 'query_value': 'exists', 'exists': msg.element == "" || document.getElementById(msg.element) != null}));
+                sendMessage({'type': 'query', 'query_id': msg.query_id, 'query_value': 'exists', 'exists': msg.element == "" || document.getElementById(msg.element) != null});
                 return;
             case 'classes':
                 sendCollection(msg.element, msg.query_id, msg.query, function(name) {return document.getElementsByClassName(name);});
@@ -703,15 +1569,9 @@ function handleJsonCommand(msg) {
                 sendCollection(msg.element, msg.query_id, msg.query, function(name){return document.getElementsByName(name);});
                 return;
             case 'ping':
-                socket.send(JSON.stringify({'type': 'query', 'query_id': msg.query_id, 'query_value': 'pong', 'pong': String(Date.now())    }));
+                sendMessage({'type': 'query', 'query_id': msg.query_id, 'query_value': 'pong', 'pong': String(Date.now())    });
                 return;
             } break;
-        case 'pull_binary':
-            httpGetBin(msg);
-            return;
-        case 'pull_json':
-            httpGetJson(msg);
-            return;
         case 'event_notify':
             if(msg.add)
                 event_notifiers.add(msg.name);
@@ -725,7 +1585,8 @@ function handleJsonCommand(msg) {
             return;
         }
     
-        const el = msg.element.length > 0 ?  document.getElementById(msg.element) : document.body;
+        const el = msg.handle !== undefined ? handleNode(msg.handle) :
+            (msg.element.length > 0 ?  document.getElementById(msg.element) : document.body);
         if(!el) {
             errlog(msg.element, 'element not found:"' + msg.element + '"');
             return;
@@ -741,11 +1602,23 @@ function handleJsonCommand(msg) {
                 log("create", el, msg.html_element, msg.new_id);
                 createElement(el, msg.html_element, msg.new_id);
                 break;
+            case 'mirror':
+                setMirror(el, msg.element, msg.properties);
+                break;
+            case 'bind':
+                addActions(el, msg.element, msg.event, msg.actions, msg.notify, msg.filters);
+                break;
+            case 'pointer_stream':
+                addPointerStream(el, msg.element);
+                break;
             case 'remove':
+                if(mirrors.has(msg.element))
+                    setMirror(el, msg.element, []);
                 removeElement(el, msg.remove);
+                handles.delete(msg.handle);
                 break;
             case 'event':
-                addEvent(el, msg.element, msg.event, msg.properties, msg.throttle);
+                addEvent(el, msg.element, msg.event, msg.properties, msg.throttle, msg.delivery, msg.filters);
                 break;
             case 'paint_image':
                 paintImage(el, msg.image, msg.pos, msg.rect, msg.clip);
@@ -753,6 +1626,15 @@ function handleJsonCommand(msg) {
             case 'canvas_draw':
                 canvasDraw(el, msg.commands);
                 break;
+            case 'canvas_scale':
+                setCanvasScale(el, msg.scale, msg.smoothing);
+                break;
+            case 'canvas_layers':
+                setCanvasLayers(el);
+                break;
+            case 'tile_draw':
+                tileDraw(el, msg.tiles, msg.evict);
+                break;
             case 'remove_attribute':
                 el.removeAttribute(msg.attribute)
                 break;
@@ -775,27 +1657,27 @@ socket.onopen = function(event) {
     log("onopen", uri, event);
     setInterval(function() {
         if(socket.readyState === 1)
-            socket.send(JSON.stringify({'type': 'keepalive'}));
+            sendMessage({'type': 'keepalive'});
     }, 10000); //decreased to help more intensive cal app messages (read mandelbrot) get passed
 
     // one guess is that in API tests there no events coming
     setTimeout(function() {
-        socket.send(JSON.stringify({'type': 'event', 
-        'element': '', 'event': 'ui_ready', 'properties':{}}));
+        sendMessage({'type': 'event', 
+        'element': '', 'event': 'ui_ready', 'properties':{}});
     }, 100);
     
-    socket.send(JSON.stringify({'type': 'ui_ready'}));
+    sendMessage({'type': 'ui_ready', 'encodings': ['msgpack']});
 };
 
 socket.onmessage =
         function(event) {
-        try {        
-            if(event.data instanceof ArrayBuffer) {
-                handleBinary(event.data);
-                return;
-            }
-            const msg = JSON.parse(event.data);
-            handleJson(msg);
+        try {
+            if(!(event.data instanceof ArrayBuffer))
+                receiveJson(JSON.parse(event.data));
+            else if(isMsgpack(event.data))
+                receiveJson(msgpackDecode(event.data));
+            else
+                receive(binaryKey(event.data), () => handleBinary(event.data));
         } catch(error) {
             catchLog(error, event.data);
         }
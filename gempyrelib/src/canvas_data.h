@@ -6,11 +6,13 @@
 
 namespace Gempyre {
 class CanvasData  {
-private:
+public:
     enum DataTypes : dataT {
-      CanvasId = 0xAAA
+      CanvasId = 0xAAA,
+      CanvasHandleId = 0xAAB    // owner id is replaced with a numeric handle, see Data::setHandle
     };
-public:
+    // bitmap tile flag in the last header word, owner is a tile cache key and not an element, see pyramid.cpp
+    static constexpr dataT CachedTileFlag = 0x4000000;
     static constexpr auto NO_ID = "";
     CanvasData(int w, int h,  std::string_view owner);
     CanvasData(int w, int h) : CanvasData(w, h, NO_ID) {}
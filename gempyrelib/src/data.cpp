@@ -8,12 +8,9 @@ template <typename T> T align(T a) {return (a + 3U) & ~3U;}
 
 constexpr auto fixedDataSize = 4;
 
-// all Data is indexed so send can keep their order in broadcaster
-static unsigned g_index_couter = 0;
-
 
 Data::Data(size_t sz, dataT type, std::string_view owner, const std::vector<dataT>& header) :
-    m_data(sz + (fixedDataSize + header.size()) + align(owner.size())), m_index(g_index_couter++) {
+    m_data(sz + (fixedDataSize + header.size()) + align(owner.size())) {
         m_data[0] = type;
         m_data[1] = static_cast<dataT>(sz);
         m_data[2] = align(static_cast<dataT>(owner.size()));
@@ -49,6 +46,15 @@ bool Data::has_owner() const {
     return m_data[2] > 0;
 }
 
+void Data::setHandle(dataT type, dataT handle) {
+    const auto idOffset = fixedDataSize + m_data[1] + m_data[3];
+    gempyre_utils_assert_x(m_data.size() > idOffset, "Data has no owner");
+    m_data[0] = type;
+    m_data[2] = sizeof(dataT) / sizeof(uint16_t); // id length is in 16 bit words
+    m_data[idOffset] = handle;
+    m_data.resize(idOffset + 1);
+}
+
 std::vector<Gempyre::dataT> Data::header() const {
     std::vector<dataT> out;
     std::copy(endPtr(), endPtr() + m_data[3], std::back_inserter(out));
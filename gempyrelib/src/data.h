@@ -51,7 +51,8 @@ class Data {
         [[nodiscard]] DataPtr clone() const;
         [[nodiscard]] size_t size() const {return m_data.size() * sizeof(dataT);}
         [[nodiscard]] bool has_owner() const;
-        [[nodiscard]] auto index() const {return m_index;}
+        void setHandle(dataT type, dataT handle); // replace owner id with a numeric handle
+        [[nodiscard]] dataT type() const {return m_data[0];}
         virtual ~Data() = default;
         Data(size_t sz, dataT type, std::string_view owner, const std::vector<dataT>& header);
         std::tuple<const char*, size_t> payload() const; // char* ?? todo
@@ -60,7 +61,6 @@ class Data {
 #endif
     private:
         std::vector<dataT> m_data;
-        const unsigned m_index;
         friend class Element;
         friend class Ui;
     };
@@ -0,0 +1,207 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <optional>
+#include <cstring>
+
+namespace Gempyre {
+
+// Operations of a batch are encoded as they are pushed, straight into buffers that take() completes as a 'batch'
+// message. A later write to the same element property tombstones the earlier operation, tombstones are compacted
+// away when the message is taken.
+class Batch {
+public:
+    using json = nlohmann::json;
+    using HandleFunction = std::function<void (json&)>;
+    using BufferFunction = std::function<std::string ()>;
+
+    // which encodings are produced, see Broadcaster::set_packed
+    struct Encodings {
+        bool text{true};
+        bool packed{false};
+    };
+
+    struct Message {
+        std::string text{};
+        std::string packed{};
+        size_t operations{0};
+    };
+
+    explicit Batch(Encodings encodings, const HandleFunction& toHandle = nullptr, const BufferFunction& buffer = nullptr) :
+        m_encodings{encodings}, m_toHandle{toHandle}, m_buffer{buffer} {
+        reset();
+    }
+
+    // returns number of earlier operations this one replaced
+    size_t push_back(json&& op) {
+        size_t replaced = 0;
+        auto key = coalesceKey(op);
+        std::optional<size_t> previous;
+        if(!key) {
+            m_latest.clear(); // structural change, earlier operations are not moved over it
+        } else {
+            const auto it = m_latest.find(*key);
+            // an operation that introduced the element handle must stay, later ones refer to it
+            if(it != m_latest.end() && !m_entries[it->second].registers)
+                previous = it->second;
+        }
+        if(m_toHandle)
+            m_toHandle(op);
+        if(previous) {
+            m_entries[*previous].live = false;
+            --m_live;
+            ++replaced;
+        }
+        Entry entry;
+        entry.registers = op.contains("handle");
+        if(m_encodings.text) {
+            entry.text_offset = m_text.size();
+            m_text += op.dump();
+            m_text += ',';
+            entry.text_size = m_text.size() - entry.text_offset;
+        }
+        if(m_encodings.packed) {
+            entry.packed_offset = m_packed.size();
+            json::to_msgpack(op, m_packed);
+            entry.packed_size = m_packed.size() - entry.packed_offset;
+        }
+        if(key)
+            m_latest[std::move(*key)] = m_entries.size();
+        m_entries.push_back(entry);
+        ++m_live;
+        return replaced;
+    }
+
+    // number of pushed operations, including replaced ones
+    size_t size() const {
+        return m_entries.size();
+    }
+
+    // completes the message and starts a new batch
+    Message take() {
+        Message message;
+        message.operations = m_live;
+        if(m_live > 0) {
+            if(m_encodings.text) {
+                compact(m_text, &Entry::text_offset, &Entry::text_size, TEXT_HEAD.size());
+                m_text.back() = ']'; // replaces the trailing comma
+                m_text += '}';
+                message.text = std::move(m_text);
+            }
+            if(m_encodings.packed) {
+                compact(m_packed, &Entry::packed_offset, &Entry::packed_size, PACKED_HEAD.size());
+                const auto count = static_cast<uint32_t>(m_live);
+                auto pos = PACKED_HEAD.size() - 4; // array32 size is big endian
+                for(auto shift = 24; shift >= 0; shift -= 8)
+                    m_packed[pos++] = static_cast<char>((count >> shift) & 0xFF);
+                message.packed = std::move(m_packed);
+            }
+        }
+        reset();
+        return message;
+    }
+
+private:
+    // element and property that an operation writes, see coalesceKey
+    struct Key {
+        enum class Kind {Html, Attribute, Style};
+        std::string element;
+        Kind kind;
+        std::string property;
+        bool operator==(const Key& other) const {
+            return kind == other.kind && element == other.element && property == other.property;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            const auto h = std::hash<std::string>{}(key.element) ^ (static_cast<size_t>(key.kind) << 1);
+            return h ^ (std::hash<std::string>{}(key.property) + 0x9e3779b9 + (h << 6) + (h >> 2));
+        }
+    };
+
+    struct Entry {
+        size_t text_offset{0};
+        size_t text_size{0};
+        size_t packed_offset{0};
+        size_t packed_size{0};
+        bool registers{false}; // carries both element id and its handle
+        bool live{true};
+    };
+
+    static constexpr std::string_view TEXT_HEAD{R"({"type":"batch","batches":[)"};
+    // fixmap(2) "type": "batch", "batches": array32(count)
+    static constexpr std::string_view PACKED_HEAD{"\x82\xa4type\xa5" "batch\xa7" "batches\xdd\0\0\0\0", 25};
+
+    void reset() {
+        m_entries.clear();
+        m_latest.clear();
+        m_live = 0;
+        if(m_encodings.text)
+            start(m_text, TEXT_HEAD);
+        if(m_encodings.packed)
+            start(m_packed, PACKED_HEAD);
+    }
+
+    void start(std::string& buffer, std::string_view head) {
+        if(m_buffer && buffer.capacity() == 0)
+            buffer = m_buffer();
+        buffer.assign(head);
+    }
+
+    // move live operations over the tombstones
+    void compact(std::string& buffer, size_t Entry::*offset, size_t Entry::*size, size_t head) const {
+        if(m_live == m_entries.size())
+            return;
+        auto pos = head;
+        for(const auto& entry : m_entries) {
+            if(!entry.live)
+                continue;
+            if(entry.*offset != pos)
+                std::memmove(&buffer[pos], &buffer[entry.*offset], entry.*size);
+            pos += entry.*size;
+        }
+        buffer.resize(pos);
+    }
+
+    // element and property that operation writes, or nullopt if it cannot be coalesced
+    static std::optional<Key> coalesceKey(const json& jobj) {
+        const auto type = jobj.find("type");
+        const auto element = jobj.find("element");
+        if(type == jobj.end() || element == jobj.end() || !type->is_string() || !element->is_string())
+            return std::nullopt;
+        const auto& t = type->get_ref<const std::string&>();
+        const auto& e = element->get_ref<const std::string&>();
+        if(t == "html")
+            return Key{e, Key::Kind::Html, {}};
+        const auto property = [&jobj](const char* name) {
+            const auto it = jobj.find(name);
+            return it != jobj.end() && it->is_string() ? it->get<std::string>() : std::string{};
+        };
+        if(t == "set_attribute" || t == "remove_attribute")
+            return Key{e, Key::Kind::Attribute, property("attribute")};
+        if(t == "set_style" || t == "remove_style")
+            return Key{e, Key::Kind::Style, property("style")};
+        return std::nullopt;
+    }
+
+private:
+    const Encodings m_encodings;
+    const HandleFunction m_toHandle;
+    const BufferFunction m_buffer;
+    std::string m_text{};
+    std::string m_packed{};
+    std::vector<Entry> m_entries{};
+    std::unordered_map<Key, size_t, KeyHash> m_latest{};
+    size_t m_live{0};
+};
+
+}
+
+#endif // BATCH_H
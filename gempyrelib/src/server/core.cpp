@@ -225,6 +225,14 @@ void Ui::end_batch() {
     });
 }
 
+void Ui::set_auto_batch(bool auto_batch) {
+    m_ui->set_auto_batch(auto_batch);
+}
+
+bool Ui::is_auto_batch() const {
+    return m_ui->is_auto_batch();
+}
+
 
 Ui::TimerId Ui::start_periodic(const std::chrono::milliseconds &ms, const std::function<void (TimerId)> &timerFunc) {
     assert(timerFunc);
@@ -341,27 +349,86 @@ std::string Ui::address_of(std::string_view filepath) const {
 }
 
 std::optional<Element::Elements> Ui::by_class(std::string_view className) const {
-    Element::Elements childArray;
     const auto childIds = m_ui->query<std::vector<std::string>>(className, "classes");
-    if(!childIds.has_value()) {
-        return std::nullopt;
-    }
-    for(const auto& cid : *childIds) {
-        childArray.push_back(Element(*const_cast<Ui*>(this), cid));
-    }
-    return *m_ui == State::RUNNING ? std::make_optional(childArray) : std::nullopt;
+    return *m_ui == State::RUNNING ? to_elements(*const_cast<Ui*>(this), childIds) : std::nullopt;
+}
+
+void Ui::by_class_async(std::string_view className, const QueryCallback<Element::Elements>& callback) const {
+    m_ui->query_async<std::vector<std::string>>(className, "classes", Server::Array{}, [this, callback](auto&& ids) {
+        callback(to_elements(*const_cast<Ui*>(this), ids));
+    });
+}
+
+std::future<std::optional<Element::Elements>> Ui::by_class_async(std::string_view className) const {
+    return query_future<Element::Elements>([this, className](const auto& callback) {by_class_async(className, callback);});
 }
 
 std::optional<Element::Elements> Ui::by_name(std::string_view className) const {
-    Element::Elements childArray;
     const auto childIds = m_ui->query<std::vector<std::string>>(className, "names");
-    if(!childIds.has_value()) {
+    return *m_ui == State::RUNNING ? to_elements(*const_cast<Ui*>(this), childIds) : std::nullopt;
+}
+
+void Ui::by_name_async(std::string_view name, const QueryCallback<Element::Elements>& callback) const {
+    m_ui->query_async<std::vector<std::string>>(name, "names", Server::Array{}, [this, callback](auto&& ids) {
+        callback(to_elements(*const_cast<Ui*>(this), ids));
+    });
+}
+
+std::future<std::optional<Element::Elements>> Ui::by_name_async(std::string_view name) const {
+    return query_future<Element::Elements>([this, name](const auto& callback) {by_name_async(name, callback);});
+}
+
+// rows of element id followed by its values in the order of properties
+static std::optional<Ui::ElementProperties> to_properties(Ui& ui, const std::vector<std::string>& properties, const std::optional<std::vector<std::vector<std::string>>>& rows) {
+    if(!rows.has_value())
         return std::nullopt;
+    Ui::ElementProperties elements;
+    elements.reserve(rows->size());
+    for(const auto& row : *rows) {
+        if(row.size() != properties.size() + 1) {
+            GempyreUtils::log(GempyreUtils::LogLevel::Error, "Invalid properties row", row.size(), properties.size());
+            continue;
+        }
+        Element::Values values;
+        for(auto i = 0U; i < properties.size(); ++i)
+            values.emplace(properties[i], row[i + 1]);
+        elements.emplace_back(Element(ui, row[0]), std::move(values));
     }
-    for(const auto& cid : *childIds) {
-        childArray.push_back(Element(*const_cast<Ui*>(this), cid));
-    }
-    return *m_ui == State::RUNNING ? std::make_optional(childArray) : std::nullopt;
+    return elements;
+}
+
+static Server::Value properties_params(const Element::Elements& elements, const std::vector<std::string>& properties) {
+    Server::Array ids;
+    ids.reserve(elements.size());
+    for(const auto& el : elements)
+        ids.push_back(el.id());
+    return Server::Object{{"elements", std::move(ids)}, {"properties", properties}};
+}
+
+static Server::Value properties_params(std::string_view selector, const std::vector<std::string>& properties) {
+    return Server::Object{{"selector", selector}, {"properties", properties}};
+}
+
+std::optional<Ui::ElementProperties> Ui::properties(const Element::Elements& elements, const std::vector<std::string>& properties) const {
+    const auto rows = m_ui->query<std::vector<std::vector<std::string>>>("", "properties", properties_params(elements, properties));
+    return *m_ui == State::RUNNING ? to_properties(*const_cast<Ui*>(this), properties, rows) : std::nullopt;
+}
+
+std::optional<Ui::ElementProperties> Ui::properties(std::string_view selector, const std::vector<std::string>& properties) const {
+    const auto rows = m_ui->query<std::vector<std::vector<std::string>>>("", "properties", properties_params(selector, properties));
+    return *m_ui == State::RUNNING ? to_properties(*const_cast<Ui*>(this), properties, rows) : std::nullopt;
+}
+
+void Ui::properties_async(const Element::Elements& elements, const std::vector<std::string>& properties, const QueryCallback<ElementProperties>& callback) const {
+    m_ui->query_async<std::vector<std::vector<std::string>>>("", "properties", properties_params(elements, properties), [this, properties, callback](auto&& rows) {
+        callback(to_properties(*const_cast<Ui*>(this), properties, rows));
+    });
+}
+
+void Ui::properties_async(std::string_view selector, const std::vector<std::string>& properties, const QueryCallback<ElementProperties>& callback) const {
+    m_ui->query_async<std::vector<std::vector<std::string>>>("", "properties", properties_params(selector, properties), [this, properties, callback](auto&& rows) {
+        callback(to_properties(*const_cast<Ui*>(this), properties, rows));
+    });
 }
 
 void Ui::extension_call(std::string_view callId, const std::unordered_map<std::string, std::any>& parameters) {
@@ -458,6 +525,16 @@ std::optional<double> Ui::device_pixel_ratio() const {
     return value.has_value() && *m_ui == State::RUNNING ? GempyreUtils::parse<double>(value.value()) : std::nullopt;
 }
 
+void Ui::device_pixel_ratio_async(const QueryCallback<double>& callback) const {
+    m_ui->query_async<std::string>("", "devicePixelRatio", Server::Array{}, [callback](auto&& value) {
+        callback(value.has_value() ? GempyreUtils::parse<double>(value.value()) : std::nullopt);
+    });
+}
+
+std::future<std::optional<double>> Ui::device_pixel_ratio_async() const {
+    return query_future<double>([this](const auto& callback) {device_pixel_ratio_async(callback);});
+}
+
 void Ui::set_application_icon(const uint8_t *data, size_t dataLen, std::string_view type) {
     extension_call("setAppIcon", {{"image_data", Base64::encode(data, dataLen)}, {"type", type}});
 }
@@ -542,6 +619,37 @@ void Ui::flush() {
     m_ui->shoot_requests();
 }
 
+void Ui::set_encoding(Encoding encoding) {
+    m_ui->set_packed(encoding == Encoding::MsgPack);
+}
+
+void Ui::set_compression(Compression compression, size_t min_size, int level) {
+    const auto mode = compression == Compression::All ? Server::Compression::Mode::All :
+        compression == Compression::Text ? Server::Compression::Mode::Text : Server::Compression::Mode::Off;
+    m_ui->set_compression({mode, min_size, level});
+}
+
+void Ui::set_lane(const std::string& type, Lane lane) {
+    m_ui->set_lane(type, lane == Lane::Bulk ? Server::Lane::Bulk : Server::Lane::Interactive);
+}
+
+static Ui::LaneDelay lane_delay(const Server::LaneDelay& delay) {
+    return Ui::LaneDelay{delay.messages,
+        std::chrono::microseconds{delay.messages > 0 ? delay.total_us / delay.messages : 0},
+        std::chrono::microseconds{delay.max_us}};
+}
+
+Ui::Traffic Ui::traffic() const {
+    const auto traffic = m_ui->traffic();
+    const auto& events = m_ui->event_queue();
+    return Traffic{traffic.messages_sent, traffic.bytes_sent, traffic.messages_received, traffic.bytes_received,
+        traffic.packed ? Encoding::MsgPack : Encoding::Json, traffic.coalesced,
+        traffic.compressed_messages, traffic.compression_ratio, std::chrono::microseconds{traffic.compression_time_us},
+        traffic.pulled_messages, traffic.pulled_bytes,
+        lane_delay(traffic.interactive), lane_delay(traffic.bulk),
+        events.size(), events.max_size(), events.coalesced()};
+}
+
  bool Ui::ui_available() const {
     return m_ui->is_ui_available();
  }
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <vector>
+#include <future>
 #include "gempyre.h"
 #include "gempyre_utils.h"
 #include "gempyre_internal.h"
@@ -36,6 +37,7 @@ struct hasKey<T,
 template <class T, std::enable_if_t<hasKey<T>::value, int> = 0>  T copy_value(const Server::Value& d);
 template <class T, std::enable_if_t<!hasKey<T>::value, int> = 0> T copy_value(const Server::Value& d);
 template <> inline std::string copy_value(const Server::Value& d);
+template <> inline Server::Value copy_value(const Server::Value& d);
 
 template <class T, std::enable_if_t<hasKey<T>::value, int>>
  T copy_value(const Server::Value& obj) {
@@ -67,26 +69,26 @@ template <>
     return GempyreInternal::to_string(d);
 }
 
+template <>
+ inline Server::Value copy_value(const Server::Value& d) {
+    return d;
+}
+
 template<typename T>
 bool is_error(const T&) {return false;}
 
 template<>
 inline bool is_error(const std::string& s) {return s == "query_error";}
 
+template<>
+inline bool is_error(const Server::Value& v) {return v.is_string() && v.get_ref<const std::string&>() == "query_error";}
+
 template<class T>
-std::optional<T> GempyreInternal::query(std::string_view elId, std::string_view queryString, const std::vector<std::string>& queryParams)  {
+std::optional<T> GempyreInternal::query(std::string_view elId, std::string_view queryString, const Server::Value& queryParams)  {
     if(*this == State::RUNNING) {
         const auto queryId = query_id();
 
-        add_request([this, queryId, elId, queryString, queryParams](){
-            return send_to(Server::TargetSocket::Ui, json{
-                    {"type", "query"},
-                    {"query_id", queryId},
-                    {"element", elId},
-                    {"query", queryString},
-                    {"query_params", queryParams}
-                    });
-        });
+        send_query(queryId, elId, queryString, queryParams);
 
         while(is_running()) {   //start waiting the response
             eventLoop(false);
@@ -111,4 +113,43 @@ std::optional<T> GempyreInternal::query(std::string_view elId, std::string_view
     }
     return std::nullopt;
 }
+template<class T>
+void GempyreInternal::query_async(std::string_view elId, std::string_view queryString, const Server::Value& queryParams,
+    std::function<void (std::optional<T>&&)>&& callback) {
+    if(*this != State::RUNNING) {
+        callback(std::nullopt);
+        return;
+    }
+    const auto queryId = query_id();
+    m_asyncqueries.push(queryId, [callback = std::move(callback), elId = std::string{elId}, queryString = std::string{queryString}](Server::Value&& value) {
+        auto response = copy_value<T>(value);
+        if(is_error(response)) {
+            GempyreUtils::log(GempyreUtils::LogLevel::Debug, "Invalid query:", elId, queryString);
+            callback(std::nullopt);
+            return;
+        }
+        callback(std::make_optional<T>(std::move(response)));
+    });
+    send_query(queryId, elId, queryString, queryParams);
+}
+
+// elements of queried ids
+inline std::optional<Element::Elements> to_elements(Ui& ui, const std::optional<std::vector<std::string>>& ids) {
+    if(!ids.has_value())
+        return std::nullopt;
+    Element::Elements elements;
+    for(const auto& id : *ids)
+        elements.push_back(Element(ui, id));
+    return elements;
+}
+
+// future of a query_async based call, value is set in the event loop, thus it must not be waited there
+template <class T, class Query>
+std::future<std::optional<T>> query_future(Query&& query) {
+    auto promise = std::make_shared<std::promise<std::optional<T>>>();
+    auto future = promise->get_future();
+    query([promise](const std::optional<T>& value) {promise->set_value(value);});
+    return future;
+}
+
 }
@@ -6,6 +6,8 @@
 #include <random>
 #include <chrono>
 #include <charconv>
+#include <cmath>
+#include <limits>
 
 // helper type for the visitor #4
 template<class... Ts>
@@ -51,13 +53,171 @@ Element::Element(Ui& ui, std::string_view htmlElement, const Element& parent) :
 }
 
 
-Element& Element::subscribe(std::string_view name, const SubscribeFunction& handler, const std::vector<std::string>& properties, const std::chrono::milliseconds& throttle) {
+const EventProperties::map_type& EventProperties::map() const {
+    if(!m_map) {
+        map_type map;
+        if(m_data) {
+            for(const auto& [k, v] : m_data->properties)
+                map.emplace(k, GempyreInternal::to_string(v));
+        }
+        m_map = std::move(map);
+    }
+    return *m_map;
+}
+
+// nullopt if the value is not a number representable as T, e.g. a fraction or a negative for an integer type
+template <class T>
+static std::optional<T> to_number(const Server::Value& value) {
+    if constexpr (std::is_floating_point_v<T>) {
+        if(!value.is_number())
+            return std::nullopt;
+        const auto v = value.get<double>();
+        if(std::abs(v) > static_cast<double>(std::numeric_limits<T>::max()))
+            return std::nullopt;
+        return static_cast<T>(v);
+    } else {
+        if(value.is_number_unsigned()) {
+            const auto v = value.get<std::uint64_t>();
+            if(v > static_cast<std::uint64_t>(std::numeric_limits<T>::max()))
+                return std::nullopt;
+            return static_cast<T>(v);
+        }
+        if(!value.is_number_integer())
+            return std::nullopt;
+        const auto v = value.get<std::int64_t>();
+        if constexpr (std::is_unsigned_v<T>) {
+            if(v < 0 || static_cast<std::uint64_t>(v) > static_cast<std::uint64_t>(std::numeric_limits<T>::max()))
+                return std::nullopt;
+        } else {
+            if(v < static_cast<std::int64_t>(std::numeric_limits<T>::min()) || v > static_cast<std::int64_t>(std::numeric_limits<T>::max()))
+                return std::nullopt;
+        }
+        return static_cast<T>(v);
+    }
+}
+
+// strings are parsed as JSON numbers, so the same values are accepted as from numbers
+template <class T>
+static std::optional<T> parse_number(std::string_view str) {
+    return to_number<T>(Server::Value::parse(str, nullptr, false));
+}
+
+template <class T>
+std::optional<T> EventProperties::get(std::string_view key) const {
+    if(!m_data) {
+        const auto it = map().find(std::string{key});
+        if(it == map().end())
+            return std::nullopt;
+        if constexpr (std::is_same_v<T, std::string>)
+            return it->second;
+        else if constexpr (std::is_same_v<T, bool>)
+            return it->second == "true";
+        else
+            return parse_number<T>(it->second);
+    }
+    const auto it = m_data->properties.find(std::string{key});
+    if(it == m_data->properties.end())
+        return std::nullopt;
+    const auto& value = it->second;
+    if constexpr (std::is_same_v<T, std::string>) {
+        return value.is_string() ? value.get<std::string>() : GempyreInternal::to_string(value);
+    } else if constexpr (std::is_same_v<T, bool>) {
+        if(value.is_boolean())
+            return value.get<bool>();
+        if(value.is_string())
+            return value.get_ref<const std::string&>() == "true";
+        return std::nullopt;
+    } else {
+        if(value.is_string())
+            return parse_number<T>(value.get_ref<const std::string&>());
+        return to_number<T>(value);
+    }
+}
+
+template std::optional<double> EventProperties::get<double>(std::string_view) const;
+template std::optional<float> EventProperties::get<float>(std::string_view) const;
+template std::optional<int> EventProperties::get<int>(std::string_view) const;
+template std::optional<unsigned> EventProperties::get<unsigned>(std::string_view) const;
+template std::optional<long long> EventProperties::get<long long>(std::string_view) const;
+template std::optional<bool> EventProperties::get<bool>(std::string_view) const;
+template std::optional<std::string> EventProperties::get<std::string>(std::string_view) const;
+
+// notification event of bound actions, see gempyre.js
+static constexpr auto ACTION_EVENT = "action:";
+
+static const char* delivery_name(Element::Delivery delivery) {
+    switch(delivery) {
+    case Element::Delivery::ThrottleTrailing: return "throttle_trailing";
+    case Element::Delivery::Debounce: return "debounce";
+    case Element::Delivery::Frame: return "frame";
+    default: return "throttle";
+    }
+}
+
+static Server::Value to_json(const std::vector<EventFilter>& filters) {
+    Server::Array array;
+    for(const auto& f : filters) {
+        const auto op = f.op == EventFilter::Op::OneOf ? "one_of" :
+            f.op == EventFilter::Op::Range ? "range" :
+            f.op == EventFilter::Op::Magnitude ? "magnitude" : "equals";
+        array.push_back(Server::Object{{"property", f.property}, {"op", op}, {"values", f.values}, {"min", f.min}, {"max", f.max}});
+    }
+    return array;
+}
+
+Element& Element::subscribe(std::string_view name, const SubscribeFunction& handler, const std::vector<std::string>& properties, const std::chrono::milliseconds& throttle,
+    Delivery delivery, const std::vector<EventFilter>& filters) {
     assert(GempyreUtils::is_valid_utf8(name));
     ref().add_handler(m_id, std::string{name}, handler);
     ref().send(*this, "event",
         "event", name,
         "properties", properties,
-        "throttle", std::to_string(throttle.count()));
+        "throttle", std::to_string(throttle.count()),
+        "delivery", delivery_name(delivery),
+        "filters", to_json(filters));
+    return *this;
+}
+
+static const char* action_name(Element::Action::Op op) {
+    using Op = Element::Action::Op;
+    switch(op) {
+    case Op::RemoveStyle: return "remove_style";
+    case Op::AddClass: return "add_class";
+    case Op::RemoveClass: return "remove_class";
+    case Op::ToggleClass: return "toggle_class";
+    case Op::SetAttribute: return "set_attribute";
+    case Op::RemoveAttribute: return "remove_attribute";
+    case Op::Show: return "show";
+    case Op::Hide: return "hide";
+    case Op::ToggleHidden: return "toggle_hidden";
+    case Op::Focus: return "focus";
+    default: return "set_style";
+    }
+}
+
+Element& Element::bind(std::string_view name, const std::vector<Action>& actions, const SubscribeFunction& notify, const std::vector<EventFilter>& filters) {
+    assert(GempyreUtils::is_valid_utf8(name));
+    Server::Array array;
+    for(const auto& a : actions)
+        array.push_back(Server::Object{{"target", a.target}, {"op", action_name(a.op)}, {"name", a.name}, {"value", a.value}});
+    if(notify)
+        ref().add_handler(m_id, ACTION_EVENT + std::string{name}, notify);
+    ref().send(*this, "bind",
+        "event", name,
+        "actions", array,
+        "notify", static_cast<bool>(notify),
+        "filters", to_json(filters));
+    return *this;
+}
+
+Element& Element::subscribe_pointer(const PointerFunction& handler) {
+    ref().add_pointer_handler(m_id, handler);
+    ref().send(*this, Server::POINTER_STREAM, true);
+    return *this;
+}
+
+Element& Element::set_coalesce(std::string_view name, Coalesce coalesce, const std::vector<std::string>& deltas) {
+    ref().set_coalesce(m_id, std::string{name}, coalesce, deltas);
     return *this;
 }
 
@@ -152,36 +312,91 @@ std::optional<std::string> Element::type() const {
     return ref() == State::RUNNING ? value : std::nullopt;
 }
 
+static std::optional<Element::Rect> to_rect(const std::optional<std::unordered_map<std::string, std::string>>& value) {
+    if(!value.has_value())
+        return std::nullopt;
+    assert(value->size() >= 4);
+    assert(value->find("x") != value->end());
+    assert(value->find("y") != value->end());
+    assert(value->find("width") != value->end());
+    assert(value->find("height") != value->end());
+    return Element::Rect{
+        GempyreUtils::parse<int>(value->at("x")).value(),
+        GempyreUtils::parse<int>(value->at("y")).value(),
+        GempyreUtils::parse<int>(value->at("width")).value(),
+        GempyreUtils::parse<int>(value->at("height")).value()};
+}
+
+static std::optional<Element> to_parent(Ui& ui, const std::optional<std::string>& pid) {
+    if(!pid || pid->empty())
+        return std::nullopt;
+    if(*pid == ": :") // see comment in JS
+        return ui.root();
+    return Element(ui, *pid);
+}
+
 std::optional<Element::Rect> Element::rect() const {
     const auto value = m_ui->ref().query<std::unordered_map<std::string, std::string>>(m_id, "bounding_rect");
-    if(ref() == State::RUNNING && value.has_value()) {
-        assert(value->size() >= 4);
-        assert(value->find("x") != value->end());
-        assert(value->find("y") != value->end());
-        assert(value->find("width") != value->end());
-        assert(value->find("height") != value->end());
-        return Rect{
-            GempyreUtils::parse<int>(value->at("x")).value(),
-            GempyreUtils::parse<int>(value->at("y")).value(),
-            GempyreUtils::parse<int>(value->at("width")).value(),
-            GempyreUtils::parse<int>(value->at("height")).value()};
-    }
+    if(ref() == State::RUNNING)
+        return to_rect(value);
     return std::nullopt;
 }
 
 std::optional<Element::Elements> Element::children() const {
-    Element::Elements childArray;
     const auto childIds = m_ui->ref().query<std::vector<std::string>>(m_id, "children");
-    if(!childIds.has_value())
-        return std::nullopt;
-    for(const auto& cid : *childIds) {
-        childArray.push_back(Element(*m_ui, cid));
+    return m_ui->ref() == State::RUNNING ? to_elements(*m_ui, childIds) : std::nullopt;
+}
+
+// [type, id, [attribute values], text, [children]]
+static Element::Node to_node(const Server::Value& value, const std::vector<std::string>& attributes) {
+    Element::Node node;
+    if(!value.is_array() || value.size() != 5) {
+        GempyreUtils::log(GempyreUtils::LogLevel::Error, "Invalid snapshot node");
+        return node;
     }
-    return m_ui->ref() == State::RUNNING ? std::make_optional(childArray) : std::nullopt;
+    node.type = value[0].get<std::string>();
+    node.id = value[1].get<std::string>();
+    const auto& values = value[2];
+    for(auto i = 0U; i < attributes.size() && i < values.size(); ++i) {
+        if(values[i].is_string())
+            node.attributes.emplace(attributes[i], values[i].get<std::string>());
+    }
+    node.text = value[3].get<std::string>();
+    node.children.reserve(value[4].size());
+    for(const auto& child : value[4])
+        node.children.push_back(to_node(child, attributes));
+    return node;
+}
+
+static Server::Value snapshot_params(const std::vector<std::string>& attributes, unsigned depth) {
+    return Server::Object{{"attributes", attributes}, {"depth", depth}};
+}
+
+std::optional<Element::Node> Element::snapshot(const std::vector<std::string>& attributes, unsigned depth) const {
+    const auto value = m_ui->ref().query<Server::Value>(m_id, "snapshot", snapshot_params(attributes, depth));
+    if(!value || m_ui->ref() != State::RUNNING)
+        return std::nullopt;
+    return to_node(*value, attributes);
+}
+
+void Element::snapshot_async(const std::vector<std::string>& attributes, unsigned depth, const QueryCallback<Node>& callback) const {
+    m_ui->ref().query_async<Server::Value>(m_id, "snapshot", snapshot_params(attributes, depth), [attributes, callback](auto&& value) {
+        callback(value ? std::make_optional(to_node(*value, attributes)) : std::nullopt);
+    });
+}
+
+Element& Element::mirror(const std::vector<std::string>& properties) {
+    ref().set_mirror(*this, properties);
+    return *this;
+}
+
+std::optional<Element::Mirrored> Element::mirrored(std::string_view property) const {
+    return m_ui->ref().mirrored(m_id, property);
 }
 
 void Element::remove() {
     ref().send(*this, "remove", m_id);
+    ref().remove_mirror(m_id);
 }
 
 
@@ -190,13 +405,83 @@ std::optional<Element> Element::parent() const {
         return std::nullopt;
     }
     const auto pid = m_ui->ref().query<std::string>(m_id, "parent");
-    if(!pid || pid->empty())
-        return std::nullopt;
-    if(*pid == ": :") // see comment in JS
-        return m_ui->root();
-    return Gempyre::Element(*m_ui, *pid);
+    return to_parent(*m_ui, pid);
 } 
- 
+
+void Element::attributes_async(const QueryCallback<Attributes>& callback) const {
+    m_ui->ref().query_async<Element::Attributes>(m_id, "attributes", Server::Array{}, callback);
+}
+
+std::future<std::optional<Element::Attributes>> Element::attributes_async() const {
+    return query_future<Attributes>([this](const auto& callback) {attributes_async(callback);});
+}
+
+void Element::styles_async(const std::vector<std::string>& keys, const QueryCallback<Values>& callback) const {
+    m_ui->ref().query_async<Element::Values>(m_id, "styles", keys, callback);
+}
+
+std::future<std::optional<Element::Values>> Element::styles_async(const std::vector<std::string>& keys) const {
+    return query_future<Values>([this, keys](const auto& callback) {styles_async(keys, callback);});
+}
+
+void Element::children_async(const QueryCallback<Elements>& callback) const {
+    m_ui->ref().query_async<std::vector<std::string>>(m_id, "children", Server::Array{}, [ui = m_ui, callback](auto&& ids) {
+        callback(to_elements(*ui, ids));
+    });
+}
+
+std::future<std::optional<Element::Elements>> Element::children_async() const {
+    return query_future<Elements>([this](const auto& callback) {children_async(callback);});
+}
+
+void Element::values_async(const QueryCallback<Values>& callback) const {
+    m_ui->ref().query_async<Element::Values>(m_id, "value", Server::Array{}, callback);
+}
+
+std::future<std::optional<Element::Values>> Element::values_async() const {
+    return query_future<Values>([this](const auto& callback) {values_async(callback);});
+}
+
+void Element::html_async(const QueryCallback<std::string>& callback) const {
+    m_ui->ref().query_async<std::string>(m_id, "innerHTML", Server::Array{}, callback);
+}
+
+std::future<std::optional<std::string>> Element::html_async() const {
+    return query_future<std::string>([this](const auto& callback) {html_async(callback);});
+}
+
+void Element::type_async(const QueryCallback<std::string>& callback) const {
+    m_ui->ref().query_async<std::string>(m_id, "element_type", Server::Array{}, callback);
+}
+
+std::future<std::optional<std::string>> Element::type_async() const {
+    return query_future<std::string>([this](const auto& callback) {type_async(callback);});
+}
+
+void Element::rect_async(const QueryCallback<Rect>& callback) const {
+    m_ui->ref().query_async<std::unordered_map<std::string, std::string>>(m_id, "bounding_rect", Server::Array{}, [callback](auto&& value) {
+        callback(to_rect(value));
+    });
+}
+
+std::future<std::optional<Element::Rect>> Element::rect_async() const {
+    return query_future<Rect>([this](const auto& callback) {rect_async(callback);});
+}
+
+void Element::parent_async(const QueryCallback<Element>& callback) const {
+    if(m_id == m_ui->root().m_id) {
+        callback(std::nullopt);
+        return;
+    }
+    m_ui->ref().query_async<std::string>(m_id, "parent", Server::Array{}, [ui = m_ui, callback](auto&& pid) {
+        callback(to_parent(*ui, pid));
+    });
+}
+
+std::future<std::optional<Element>> Element::parent_async() const {
+    return query_future<Element>([this](const auto& callback) {parent_async(callback);});
+}
+
 HtmlStream Element::html_stream() {
     return HtmlStream{[this](HtmlStream& stream) {
         set_html(stream.str()); // view not implemented in clang (yet?)
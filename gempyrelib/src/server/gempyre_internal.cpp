@@ -1,6 +1,7 @@
 #include "gempyre_internal.h"
 #include "gempyre.js.h"
 #include "data.h"
+#include <cstring>
 
 using namespace Gempyre;
 
@@ -262,8 +263,12 @@ GempyreInternal& Ui::ref() {
                             m_server->flush(); // try resend after 50ms
                         });
                         return true;
-                    });}
+                    });},
+                   m_compression
                 );
+    m_server->setPacked(m_packed);
+    for(const auto& [type, lane] : m_lanes)
+        m_server->setLane(type, lane);
     }} {}
 
     void GempyreInternal::messageHandler(Server::Object&& params) {
@@ -272,16 +277,18 @@ GempyreInternal& Ui::ref() {
             const auto type = it->second;
             GempyreUtils::log(GempyreUtils::LogLevel::Debug, "message received:", type);
             if(type == "event") {
-                const auto element = params.at("element");
-                const auto event = params.at("event");
-                const auto properties = params.at("properties");
-                //const auto properties = convert(properties_map);
-                push_event({element, event, properties});
+                push_event({params.at("element"), params.at("event"), std::move(params.at("properties").get_ref<Server::Object&>())});
+            } else if(type == "events") { // see Element::Delivery::Frame
+                for(const auto& ev : params.at("events")) {
+                    push_event({ev.at("element"), ev.at("event"), ev.at("properties")});
+                }
             } else if(type == "query") {
                 const std::string key = params.at("query_value");
                 auto id = params.at("query_id");
                 auto k = params.at(key);
                 push_response(std::move(id), std::move(k));
+            } else if(type == "mirror") {
+                mirror_values(params.at("element"), params.at("values"), params.at("seq"));
             } else if(type == "extension_response") {
                 gempyre_utils_assert_x(containsAll(keys(params), {"extension_id", "extension_call"}), "extension_response invalid parameters");
                 auto id = params.at("extension_id");
@@ -462,6 +469,76 @@ std::string GempyreInternal::to_string(const nlohmann::json& js) {
 }
 
 
+// 32 bytes, little endian: float64 timestamp, float32 x, y, pressure, uint32 buttons, pointer id, kind
+std::vector<PointerSample> GempyreInternal::to_samples(const Server::Value::binary_t& bytes) {
+    constexpr auto SAMPLE_SIZE = 32U;
+    std::vector<PointerSample> samples(bytes.size() / SAMPLE_SIZE);
+    const auto* data = bytes.data();
+    for(auto& sample : samples) {
+        std::memcpy(&sample.timestamp, data, 8);
+        std::memcpy(&sample.x, data + 8, 4);
+        std::memcpy(&sample.y, data + 12, 4);
+        std::memcpy(&sample.pressure, data + 16, 4);
+        std::memcpy(&sample.buttons, data + 20, 4);
+        std::memcpy(&sample.pointer_id, data + 24, 4);
+        std::memcpy(&sample.kind, data + 28, 4);
+        data += SAMPLE_SIZE;
+    }
+    return samples;
+}
+
+// values are stale if the UI had not applied the latest write to them when it pushed
+void GempyreInternal::mirror_values(const std::string& id, const Server::Value& values, unsigned long long seq) {
+    const auto now = std::chrono::steady_clock::now();
+    const std::lock_guard<std::mutex> lock(m_mirrorMutex);
+    const auto it = m_mirror.find(id);
+    if(it == m_mirror.end())
+        return; // not mirrored anymore
+    for(const auto& [key, value] : values.items()) {
+        const auto property = it->second.find(key);
+        if(property != it->second.end())
+            property->second.value = Element::Mirrored{to_string(value), now, seq < property->second.written};
+    }
+}
+
+// A write that changes mirrored properties is tagged with a sequence number, the UI pushes the values once it has
+// applied it and tells the latest number it has applied. Writes that do not change them, e.g. an event, are not tagged
+// as the UI does not push after them.
+void GempyreInternal::mirror_modified(const std::string& id, Server::Value& params) {
+    if(!m_mirroring)
+        return;
+    const std::string type = params.at("type");
+    const auto changes = [&type, &params](const std::string& property) {
+        if(type == "remove")
+            return true;
+        if(type == "html")
+            return property == "innerHTML";
+        if(type == "set_style" || type == "remove_style")
+            return property == "attribute:style";
+        if(type == "set_attribute" || type == "remove_attribute") {
+            const std::string attribute = params.at("attribute");
+            return property == "attribute:" + attribute || ((attribute == "value" || attribute == "checked") && property == attribute);
+        }
+        return false;
+    };
+    const std::lock_guard<std::mutex> lock(m_mirrorMutex);
+    const auto it = m_mirror.find(id);
+    if(it == m_mirror.end())
+        return;
+    std::optional<unsigned long long> seq;
+    for(auto& [key, property] : it->second) {
+        if(!changes(key))
+            continue;
+        if(!seq)
+            seq = ++m_mirrorSeq;
+        property.written = *seq;
+        if(property.value)
+            property.value->stale = true;
+    }
+    if(seq)
+        params["mirror_seq"] = *seq;
+}
+
 void GempyreInternal::eventLoop(bool is_main) {
     GEM_DEBUG("enter", is_main, is_running());
     const GempyreInternal::LoopWatch loop_watch (*this, is_main);
@@ -559,6 +636,10 @@ void GempyreInternal::eventLoop(bool is_main) {
             GempyreUtils::log(GempyreUtils::LogLevel::Debug, "skip eventqueue", state_str());
         }
 
+        // async query callbacks are not called within a nested query
+        if(is_main)
+            consume_async_responses();
+
         //events must be last as they may generate more requests or responses
         consume_events();
 #if 0
@@ -575,18 +656,24 @@ void GempyreInternal::eventLoop(bool is_main) {
 void GempyreInternal::shoot_requests() {
     GempyreUtils::log(GempyreUtils::LogLevel::Debug, 
     "shoot_requests",  has_requests(), "running", *this == State::RUNNING, "available", is_ui_available());
+    // all requests made since the previous round are sent as a single batch
+    const auto batch = m_auto_batch && has_requests() && *this == State::RUNNING && is_ui_available();
+    if(batch)
+        m_server->beginBatch();
     //shoot pending requests
     while(has_requests() && *this == State::RUNNING && is_ui_available()) {
         GempyreUtils::log(GempyreUtils::LogLevel::Debug_Trace, "do request");
         auto topRequest = take_request();
         if(!topRequest) // since "flush" can be called in another thread this can happen :-o
-            return;
+            break;
         if(!topRequest()) { //yes I wanna  mutex to be unlocked
             if( ! has_requests())
                 std::this_thread::sleep_for(10ms); // busyness
             put_request(std::move(topRequest));
         }
     }
+    if(batch)
+        m_server->endBatch();
 }
 
 void GempyreInternal::send(const DataPtr& data, bool droppable) {
@@ -622,7 +709,7 @@ std::function<void(int)> GempyreInternal::makeCaller(const std::function<void (U
 
 void GempyreInternal::consume_events() {
         while(has_events() && *this == State::RUNNING) {
-            const auto it = m_eventqueue.take();
+            auto it = m_eventqueue.take();
             if(it.element.empty()) {
                  GempyreUtils::log(GempyreUtils::LogLevel::Debug,
                   "Root got event:", it.handler,
@@ -633,12 +720,13 @@ void GempyreInternal::consume_events() {
             }
             const auto element = m_elements.find(it.element);
             if(element != m_elements.end()) {
-                const auto handlerName = it.handler;
-                const auto handlers = std::get<1>(*element);
+                const auto& handlerName = it.handler;
+                const auto& handlers = std::get<1>(*element);
                 const auto h = handlers.find(handlerName);
 
                 if(h != handlers.end()) {
-                    h->second(Event{Element(*m_app_ui, std::move(element->first)), std::move(it.data)});
+                    const auto handler = h->second; // handler may change the handlers
+                    handler(Event{Element(*m_app_ui, element->first), std::make_shared<const EventData>(EventData{std::move(it.data)})});
                 } else {
                     GempyreUtils::log(GempyreUtils::LogLevel::Debug, "Cannot find a handler", handlerName, "for element", it.element);
                 }
@@ -6,6 +6,7 @@
 #include "server.h"
 #include "semaphore.h"
 #include "eventqueue.h"
+#include "input_queue.h"
 #include "base64.h"
 #include "timequeue.h"
 #include <cassert>
@@ -54,17 +55,18 @@ namespace Gempyre {
 // this class methods follows snake style
 // intention is to change eveything to snake for time being
 // by time being style is a mess
+// event properties as UI sent them, shared with the Gempyre::Event given to handlers
+struct EventData {
+    Server::Object properties;
+};
+
 class GempyreInternal {
     struct Event {
         Element element;
-        const Server::Object properties;
+        std::shared_ptr<const EventData> data;
     };
 
-    struct HandlerEvent {
-        std::string element;
-        std::string handler;
-        Server::Object data;
-        };
+    using HandlerEvent = InputQueue::Event;
 
     using HandlerFunction = std::function<void (const Event& el)>;
     using HandlerMap = std::unordered_map<std::string, HandlerFunction>;
@@ -115,7 +117,12 @@ public:
     bool operator!=(State state) const {return m_status != state;}
 
     template<class T>
-    std::optional<T> query(std::string_view elId, std::string_view queryString, const std::vector<std::string>& queryParams = {});
+    std::optional<T> query(std::string_view elId, std::string_view queryString, const Server::Value& queryParams = Server::Array{});
+
+    // returns immediately, callback is called in the event loop, but not within a nested query
+    template<class T>
+    void query_async(std::string_view elId, std::string_view queryString, const Server::Value& queryParams,
+        std::function<void (std::optional<T>&&)>&& callback);
 
     void eventLoop(bool is_main);
 
@@ -129,6 +136,7 @@ public:
             {type, value},
             {"msgid", next_msg_id()}
             };
+        mirror_modified(el.m_id, params);
         add_request([this, params = std::move(params)]() mutable {        
             return send_to(Server::TargetSocket::Ui, std::move(params));
         });    
@@ -145,6 +153,7 @@ public:
         constexpr auto count = sizeof...(pairs);
         static_assert((count & 0x1) == 0, "Expect is even");
         emplace_in<count>(std::forward_as_tuple(pairs...), params);
+        mirror_modified(el.m_id, params);
         add_request([this, params = std::move(params)]() mutable {        
             return send_to(Server::TargetSocket::Ui, std::move(params));
         });    
@@ -157,6 +166,7 @@ public:
             {"type", type},
             {type, value}
             };
+        mirror_modified(el.m_id, params);
         add_request([this, params = std::move(params)]() mutable {    
             return send_to(Server::TargetSocket::Ui, std::move(params));
         });    
@@ -173,6 +183,7 @@ public:
         constexpr auto count = sizeof...(pairs);
         static_assert((count & 0x1) == 0, "Expect is even");
         emplace_in<count>(std::forward_as_tuple(pairs...), params);
+        mirror_modified(el.m_id, params);
         add_request([this, params = std::move(params)]() mutable {        
             return send_to(Server::TargetSocket::Ui, std::move(params));
         });        
@@ -214,19 +225,29 @@ public:
 
     void add_handler(const std::string& id, const std::string& name, const Element::SubscribeFunction& handler) {
         HandlerFunction hf = [handler](const Event& event) {
-            std::unordered_map<std::string, std::string> property_map;
-            for(const auto& [k, v] : event.properties) {
-                //const auto str_value = GempyreUtils::to_str(v.value());
-                std::string value = to_string(v);
-                property_map.emplace(k, std::move(value));
-            }
-            Gempyre::Event ev{event.element, std::move(property_map)};
+            Gempyre::Event ev{event.element, EventProperties{event.data}};
             handler(ev);
             };
 
         m_elements[id].emplace(name, std::move(hf));
     }
 
+    // replaces a handler added before for the same event of the element
+    void set_handler(const std::string& id, const std::string& name, const Element::SubscribeFunction& handler) {
+        m_elements[id].erase(name);
+        add_handler(id, name, handler);
+    }
+
+    void add_pointer_handler(const std::string& id, const Element::PointerFunction& handler) {
+        HandlerFunction hf = [handler](const Event& event) {
+            const auto& properties = event.data->properties;
+            const auto samples = properties.find("samples");
+            if(samples != properties.end() && samples->second.is_binary())
+                handler(event.element, to_samples(samples->second.get_binary()));
+        };
+        m_elements[id].emplace(Server::POINTER_STREAM, std::move(hf));
+    }
+
     void clear_handlers() {
         m_elements.clear();
     }
@@ -245,6 +266,14 @@ public:
         m_eventqueue.push(std::move(event));
     }
 
+    void set_coalesce(const std::string& id, const std::string& name, Element::Coalesce coalesce, const std::vector<std::string>& deltas) {
+        m_eventqueue.set_policy(id, name, coalesce, deltas);
+    }
+
+    const InputQueue& event_queue() const {
+        return m_eventqueue;
+    }
+
 
     std::optional<Server::Value> take_response(const std::string& queryId) {
          if(m_responsemap.contains(queryId)) {
@@ -255,7 +284,19 @@ public:
     }
 
     void push_response(std::string&& id, Server::Value&& response) {
-         m_responsemap.push(std::move(id), std::move(response));
+        if(m_asyncqueries.contains(id)) {
+            m_asyncresponses.push({m_asyncqueries.take(id), std::move(response)});
+            signal_pending();
+            return;
+        }
+        m_responsemap.push(std::move(id), std::move(response));
+    }
+
+    void consume_async_responses() {
+        while(!m_asyncresponses.empty() && *this == State::RUNNING) {
+            auto response = m_asyncresponses.take();
+            response.callback(std::move(response.value));
+        }
     }
 
     void call_error(const std::string& src, std::string err) {
@@ -305,10 +346,96 @@ public:
         return m_server->send(target, std::move(value));
     }
 
+    void send_query(const std::string& queryId, std::string_view elId, std::string_view queryString, const Server::Value& queryParams) {
+        add_request([this, queryId, elId = std::string{elId}, queryString = std::string{queryString}, queryParams](){
+            return send_to(Server::TargetSocket::Ui, json{
+                    {"type", "query"},
+                    {"query_id", queryId},
+                    {"element", elId},
+                    {"query", queryString},
+                    {"query_params", queryParams}
+                    });
+        });
+    }
+
     unsigned port() const {
         return m_server->port();
     }
 
+    Server::Pressure pressure() const {
+        return m_server ? m_server->pressure() : Server::Pressure{};
+    }
+
+    Server::Traffic traffic() const {
+        return m_server ? m_server->traffic() : Server::Traffic{};
+    }
+
+    void set_packed(bool packed) {
+        m_packed = packed;
+        if(m_server)
+            m_server->setPacked(packed);
+    }
+
+    bool is_packed() const {
+        return m_packed;
+    }
+
+    void set_lane(const std::string& type, Server::Lane lane) {
+        m_lanes[type] = lane;
+        if(m_server)
+            m_server->setLane(type, lane);
+    }
+
+    // element properties the UI pushes, see Element::mirror
+    void set_mirror(const Element& el, const std::vector<std::string>& properties) {
+        {
+            const std::lock_guard<std::mutex> lock(m_mirrorMutex);
+            if(properties.empty()) {
+                m_mirror.erase(el.m_id);
+            } else {
+                auto& mirrored = m_mirror[el.m_id];
+                std::unordered_map<std::string, Mirror> values;
+                for(const auto& p : properties) {
+                    const auto it = mirrored.find(p);
+                    values.emplace(p, it != mirrored.end() ? std::move(it->second) : Mirror{});
+                }
+                mirrored = std::move(values);
+            }
+            m_mirroring = !m_mirror.empty();
+        }
+        send(el, "mirror", "properties", properties);
+    }
+
+    std::optional<Element::Mirrored> mirrored(const std::string& id, std::string_view property) const {
+        const std::lock_guard<std::mutex> lock(m_mirrorMutex);
+        const auto it = m_mirror.find(id);
+        if(it == m_mirror.end())
+            return std::nullopt;
+        const auto value = it->second.find(std::string{property});
+        return value != it->second.end() ? value->second.value : std::nullopt;
+    }
+
+    void remove_mirror(const std::string& id) {
+        if(!m_mirroring)
+            return;
+        const std::lock_guard<std::mutex> lock(m_mirrorMutex);
+        m_mirror.erase(id);
+        m_mirroring = !m_mirror.empty();
+    }
+
+    // applies when server is created
+    void set_compression(const Server::Compression& compression) {
+        m_compression = compression;
+    }
+
+    void set_auto_batch(bool auto_batch) {
+        m_auto_batch = auto_batch;
+    }
+
+    bool is_auto_batch() const {
+        return m_auto_batch;
+    }
+
     void set_hold(bool on_hold) {
         m_hold = on_hold;
     }
@@ -499,6 +626,8 @@ public:
     }
 
     void clear() {
+        m_asyncqueries.clear();
+        m_asyncresponses.clear();
         m_eventqueue.clear();
         m_requestqueue.clear();
         m_timerqueue.clear();
@@ -515,6 +644,9 @@ public:
     void pendingClose();
     bool startListen(const std::string& indexHtml, const std::unordered_map<std::string, std::string>& parameters, int listen_port);
     static std::string to_string(const nlohmann::json& js);
+    static std::vector<PointerSample> to_samples(const Server::Value::binary_t& bytes);
+    void mirror_values(const std::string& id, const Server::Value& values, unsigned long long seq);
+    void mirror_modified(const std::string& id, Server::Value& params);
     std::function<void(int)> makeCaller(const std::function<void (Ui::TimerId id)>& function);
     void consume_events();
     void shoot_requests(); 
@@ -526,8 +658,15 @@ public:
 private:
     Ui* m_app_ui;
     std::atomic<State> m_status = State::NOTSTARTED;
-    EventQueue<HandlerEvent> m_eventqueue{};
+    InputQueue m_eventqueue{};
     EventMap<std::string, Server::Value> m_responsemap{};
+    using QueryCallback = std::function<void (Server::Value&&)>;
+    struct AsyncResponse {
+        QueryCallback callback;
+        Server::Value value;
+    };
+    EventMap<std::string, QueryCallback> m_asyncqueries{};
+    EventQueue<AsyncResponse> m_asyncresponses{};
     Semaphore  m_sema{};
     TimerMgr m_timers{};
     std::unordered_map<std::string, HandlerMap> m_elements{};
@@ -544,6 +683,19 @@ private:
     // protect request_queue
     std::mutex m_requestMutex{};
     bool m_hold{false};
+    std::atomic_bool m_packed{true};
+    std::atomic_bool m_auto_batch{true};
+    Server::Compression m_compression{};
+    std::unordered_map<std::string, Server::Lane> m_lanes{};
+    // protect mirror
+    mutable std::mutex m_mirrorMutex{};
+    struct Mirror {
+        std::optional<Element::Mirrored> value{};
+        unsigned long long written{0};  // sequence number of the last write that changes the property
+    };
+    std::unordered_map<std::string, std::unordered_map<std::string, Mirror>> m_mirror{};
+    unsigned long long m_mirrorSeq{0};
+    std::atomic_bool m_mirroring{false};
     unsigned m_msgId{1};
     int m_loop{0};
 };
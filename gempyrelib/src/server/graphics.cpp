@@ -4,8 +4,12 @@
 #include "canvas_data.h"
 #include "gempyre_internal.h"
 #include "gempyre_bitmap.h"
+#include "quality.h"
 #include <any>
 #include <cassert>
+#include <array>
+#include <limits>
+#include <unordered_map>
 
 
 using namespace Gempyre;
@@ -13,10 +17,42 @@ using namespace Gempyre;
 static constexpr auto TileWidth = 640;  // used for server spesific stuff - bigger than a limit (16384) causes random crashes (There is a issue somewhere, this not really work if something else)
 static constexpr auto TileHeight = 640; // as there are some header info
 
+struct CanvasElement::RenderScale {
+    int width{0};
+    int height{0};
+    double dpr{0};
+    ResizeCallback on_resize{};
+};
+
+struct CanvasElement::Adaptive {
+    bool enabled{false};
+    QualityController controller{};
+    QualityCallback on_change{};
+};
+
+// bitmap tile flags in the last header word, see handleBinary in gempyre.js
+static constexpr dataT AsDrawFlag = 0x1;
+static constexpr auto ScaleShift = 8;       // scale factor to upscale tile on client
+static constexpr dataT Rgb565Flag = 0x10000; // two pixels per word
+static constexpr dataT StagedFlag = 0x1000000; // tile is shown on layer commit
+static constexpr dataT CommitFlag = 0x2000000; // show staged tiles of layers
+// CanvasData::CachedTileFlag is a pyramid tile, see pyramid.cpp
+
+struct CanvasLayers::Layers {
+    int width{0};
+    int height{0};
+    std::vector<CanvasElement> canvases{};
+    std::vector<Bitmap> bitmaps{};
+    std::vector<CanvasDataPtr> presented{}; // what the client has, null if not known
+    CanvasDataPtr commit{};
+};
+
 
  CanvasElement::CanvasElement(const CanvasElement& other)
         : Element{other},
           m_tile{other.m_tile},
+          m_render{other.m_render},
+          m_adaptive{other.m_adaptive},
           m_width{other.m_width},
           m_height{other.m_height}{
     }
@@ -24,23 +60,27 @@ static constexpr auto TileHeight = 640; // as there are some header info
 CanvasElement::CanvasElement(CanvasElement&& other)
         : Element{std::move(other)},
             m_tile{std::move(other.m_tile)},
+            m_render{std::move(other.m_render)},
+            m_adaptive{std::move(other.m_adaptive)},
             m_width{other.m_width},
             m_height{other.m_height}{
     }
 
 CanvasElement::CanvasElement(Ui& ui, std::string_view id)
-        : Element(ui, id) {}
+        : Element(ui, id), m_adaptive{std::make_shared<Adaptive>()} {}
     
 CanvasElement::CanvasElement(Ui& ui, std::string_view id, const Element& parent)
-        : Element(ui, id, "canvas", parent) {}
+        : Element(ui, id, "canvas", parent), m_adaptive{std::make_shared<Adaptive>()} {}
 
 CanvasElement::CanvasElement(Ui& ui, const Element& parent)
-        : Element(ui, "canvas", parent) {}
+        : Element(ui, "canvas", parent), m_adaptive{std::make_shared<Adaptive>()} {}
         
 
 // Copy operator. 
 CanvasElement& CanvasElement::operator=(const CanvasElement& other) {
     m_tile = other.m_tile;
+    m_render = other.m_render;
+    m_adaptive = other.m_adaptive;
     m_width = other.m_width;
     m_height = other.m_height;
     return *this;
@@ -49,6 +89,8 @@ CanvasElement& CanvasElement::operator=(const CanvasElement& other) {
 /// Move operator.
 CanvasElement& CanvasElement::operator=(CanvasElement&& other) {
     m_tile = std::move(other.m_tile);
+    m_render = std::move(other.m_render);
+    m_adaptive = std::move(other.m_adaptive);
     m_width = other.m_width;
     m_height = other.m_height;
     return *this;
@@ -59,7 +101,35 @@ CanvasElement::~CanvasElement() {
 }
 
 
-void CanvasElement::paint(const CanvasDataPtr& canvas, int x_pos, int y_pos, bool as_draw) {
+// box filter to a scale times smaller canvas
+static CanvasDataPtr downscale(const CanvasData& canvas, int scale) {
+    const auto width = (canvas.width() + scale - 1) / scale;
+    const auto height = (canvas.height() + scale - 1) / scale;
+    auto small = std::make_shared<CanvasData>(width, height);
+    for(auto j = 0; j < height; ++j) {
+        for(auto i = 0; i < width; ++i) {
+            dataT r = 0, g = 0, b = 0, a = 0, count = 0;
+            for(auto y = j * scale; y < std::min((j + 1) * scale, canvas.height()); ++y) {
+                for(auto x = i * scale; x < std::min((i + 1) * scale, canvas.width()); ++x) {
+                    const auto pixel = canvas.get(x, y);
+                    r += Color::r(pixel);
+                    g += Color::g(pixel);
+                    b += Color::b(pixel);
+                    a += Color::alpha(pixel);
+                    ++count;
+                }
+            }
+            small->put(i, j, Color::rgba(r / count, g / count, b / count, a / count));
+        }
+    }
+    return small;
+}
+
+static uint16_t to_rgb565(dataT pixel) {
+    return static_cast<uint16_t>(((Color::r(pixel) >> 3) << 11) | ((Color::g(pixel) >> 2) << 5) | (Color::b(pixel) >> 3));
+}
+
+void CanvasElement::paint(const CanvasDataPtr& canvas, int x_pos, int y_pos, bool as_draw, dataT extra_flags) {
     GempyreUtils::log(GempyreUtils::LogLevel::Debug, "paint", x_pos, y_pos, as_draw);
     if(!canvas) {
         GempyreUtils::log(GempyreUtils::LogLevel::Error, "Won't paint as canvas is NULL");
@@ -74,6 +144,25 @@ void CanvasElement::paint(const CanvasDataPtr& canvas, int x_pos, int y_pos, boo
         return;
     }
 
+    auto level = Quality::Full;
+    if(m_adaptive && m_adaptive->enabled) {
+        const auto previous = m_adaptive->controller.level();
+        const auto frame_bytes = static_cast<size_t>(canvas->width()) * static_cast<size_t>(canvas->height()) * sizeof(dataT);
+        level = m_adaptive->controller.update(ref().pressure(), frame_bytes, QualityController::Clock::now());
+        if(level != previous) {
+            GempyreUtils::log(GempyreUtils::LogLevel::Debug, "Canvas quality changed", m_id, static_cast<int>(level));
+            if(m_adaptive->on_change)
+                ui().after(0ms, [cb = m_adaptive->on_change, level]() {cb(level);});
+        }
+    }
+
+    // on lower quality levels bitmap is send as smaller and client scales it back
+    const auto scale = QualityController::scale(level);
+    const auto packed = QualityController::packed(level);
+    const auto source = scale > 1 ? downscale(*canvas, scale) : canvas;
+    const auto flags = (scale > 1 ? static_cast<dataT>(scale) << ScaleShift : 0) | (packed ? Rgb565Flag : 0) | extra_flags;
+    const auto staged = (extra_flags & StagedFlag) != 0;
+
     // This is not ok - as we dont know all extents
     // if (y_pos + canvas->height() < 0 || x_pos + canvas->width() < 0) {
     //    return; 
@@ -81,10 +170,12 @@ void CanvasElement::paint(const CanvasDataPtr& canvas, int x_pos, int y_pos, boo
         
     //const auto canvas_height = y_pos < 0 ? canvas->height() + y_pos : canvas->height();
     const auto canvas_height =  canvas->height();
+    const auto source_height = source->height();
 
     const auto y = y_pos < 0 ? -y_pos : 0;
     //const auto canvas_width = x_pos < 0 ? canvas->width() + x_pos : canvas->width();
     const auto canvas_width =  canvas->width();
+    const auto source_width = source->width();
     const auto x = x_pos < 0 ? -x_pos : 0;
 
     x_pos = std::max(0, x_pos);
@@ -96,25 +187,33 @@ void CanvasElement::paint(const CanvasDataPtr& canvas, int x_pos, int y_pos, boo
 
     if(y < canvas_height && x < canvas_width) {
 
-        for(auto j = y ; j < canvas_height ; j += TileHeight) {
-            const auto height = std::min(TileHeight, canvas_height - j);
-            for(auto i = x ; i < canvas_width ; i += TileWidth) {
+        for(auto j = y / scale ; j < source_height ; j += TileHeight) {
+            const auto height = std::min(TileHeight, source_height - j);
+            for(auto i = x / scale ; i < source_width ; i += TileWidth) {
                 assert(!is_last);
-                is_last = (canvas_height - j <= TileHeight) && (canvas_width - i <= TileWidth);
-                const auto width = std::min(TileWidth, canvas_width - i);
-                const auto srcPos = canvas->data() + i + (j * canvas->width());
+                is_last = (source_height - j <= TileHeight) && (source_width - i <= TileWidth);
+                const auto width = std::min(TileWidth, source_width - i);
+                const auto srcPos = source->data() + i + (j * source_width);
                 GempyreUtils::log(GempyreUtils::LogLevel::Debug_Trace, "Copy canvas frame", i, j, width, height);
-                for(int h = 0; h < height; h++) {
-                    const auto lineStart = srcPos + (h * canvas->width());
-                    auto trgPos = m_tile->data() + width * h;
-                    assert(trgPos < m_tile->data() + m_tile->width() * m_tile->height());
-                    std::copy(lineStart, lineStart + width, trgPos);
+                if(packed) {
+                    auto trgPos = reinterpret_cast<uint16_t*>(m_tile->data());
+                    for(int h = 0; h < height; h++) {
+                        const auto lineStart = srcPos + (h * source_width);
+                        trgPos = std::transform(lineStart, lineStart + width, trgPos, to_rgb565);
+                    }
+                } else {
+                    for(int h = 0; h < height; h++) {
+                        const auto lineStart = srcPos + (h * source_width);
+                        auto trgPos = m_tile->data() + width * h;
+                        assert(trgPos < m_tile->data() + m_tile->width() * m_tile->height());
+                        std::copy(lineStart, lineStart + width, trgPos);
+                    }
                 }
-                m_tile->ref().writeHeader({static_cast<Gempyre::dataT>(i + x_pos),
-                                    static_cast<Gempyre::dataT>(j + y_pos),
-                                    static_cast<Gempyre::dataT>(width),
-                                    static_cast<Gempyre::dataT>(height),
-                                    static_cast<Gempyre::dataT>(as_draw && is_last)});
+                m_tile->ref().writeHeader({static_cast<Gempyre::dataT>(i * scale + x_pos),
+                                    static_cast<Gempyre::dataT>(j * scale + y_pos),
+                                    static_cast<Gempyre::dataT>(std::min(width * scale, canvas_width - i * scale)),
+                                    static_cast<Gempyre::dataT>(std::min(height * scale, canvas_height - j * scale)),
+                                    static_cast<Gempyre::dataT>((as_draw && is_last) ? AsDrawFlag | flags : flags)});
                 
                 GempyreUtils::log(GempyreUtils::LogLevel::Debug, "Sending canvas frame", i, j, width, height, m_tile->size(),  (width * height + 4) * 4 + 20 + 16);
                 #ifdef GEMPYRE_IS_DEBUG
@@ -123,7 +222,7 @@ void CanvasElement::paint(const CanvasDataPtr& canvas, int x_pos, int y_pos, boo
                 }
             //  assert(m_tile->size() == static_cast<size_t>((width * height + 4) * 4 + 20 + 16));
                 #endif         
-                ref().send(m_tile->ptr(), is_last); // last is not droppable
+                ref().send(m_tile->ptr(), is_last && !staged); // last is not droppable, staged are never
             }
         }
     } else {
@@ -252,16 +351,22 @@ void CanvasElement::draw_completed(const DrawCallback& drawCallback, DrawNotify
             ui().after(0ms, drawCallback);
         }
 
-        subscribe("event_notify", [drawCallback](const Event& ev) {
+        subscribe("event_notify", [drawCallback, adaptive = m_adaptive, ui = m_ui](const Event& ev) {
             if(ev.properties.at("name") == "canvas_draw") {
-                drawCallback();
+                if(adaptive && adaptive->enabled && adaptive->controller.level() == Quality::Minimal)
+                    ui->after(QualityController::MINIMAL_FRAME_INTERVAL, drawCallback);
+                else
+                    drawCallback();
             }
         });  
     }         
 }
 
 void CanvasElement::erase(bool resized) {
-    if(resized || m_width <= 0 || m_height <= 0) {
+    if(m_render && m_render->width > 0 && m_render->height > 0) {
+        m_width = m_render->width;
+        m_height = m_render->height;
+    } else if(resized || m_width <= 0 || m_height <= 0) {
         const auto rv = rect();
         if(rv) {
             m_width = rv->width;
@@ -280,7 +385,390 @@ void CanvasElement::erase(bool resized) {
     draw(fc);
 }
 
+void CanvasElement::set_render_scale(double scale, Smoothing smoothing, const ResizeCallback& onResize) {
+    if(scale < 0) {
+        GempyreUtils::log(GempyreUtils::LogLevel::Error, "Invalid render scale", scale);
+        return;
+    }
+    if(!m_render)
+        m_render = std::make_shared<RenderScale>();
+    // latest call owns the size reports, also if another CanvasElement of the same id set them before
+    ref().set_handler(m_id, "canvas_resize", [render = m_render](const Event& ev) {
+        const auto width = GempyreUtils::parse<int>(ev.properties.at("width"));
+        const auto height = GempyreUtils::parse<int>(ev.properties.at("height"));
+        const auto dpr = GempyreUtils::parse<double>(ev.properties.at("dpr"));
+        if(!width || !height) {
+            GempyreUtils::log(GempyreUtils::LogLevel::Error, "Invalid canvas size", ev.properties.at("width"), ev.properties.at("height"));
+            return;
+        }
+        const auto changed = render->width != *width || render->height != *height;
+        render->width = *width;
+        render->height = *height;
+        render->dpr = dpr.value_or(render->dpr);
+        if(changed && render->on_resize)
+            render->on_resize(*width, *height);
+    });
+    m_render->on_resize = onResize;
+    ref().send(*this, "canvas_scale",
+        "scale", scale,
+        "smoothing", smoothing == Smoothing::Nearest ? "nearest" : "smooth");
+}
+
+std::optional<std::pair<int, int>> CanvasElement::render_size() const {
+    if(!m_render || m_render->width <= 0 || m_render->height <= 0)
+        return std::nullopt;
+    return std::make_pair(m_render->width, m_render->height);
+}
+
+void CanvasElement::set_adaptive_quality(bool adaptive, const QualityCallback& onChange) {
+    if(!m_adaptive)
+        m_adaptive = std::make_shared<Adaptive>();
+    if(!adaptive)
+        m_adaptive->controller = QualityController{};
+    m_adaptive->enabled = adaptive;
+    m_adaptive->on_change = onChange;
+}
+
+CanvasElement::Quality CanvasElement::quality() const {
+    return m_adaptive && m_adaptive->enabled ? m_adaptive->controller.level() : Quality::Full;
+}
+
 void CanvasElement::draw(int x, int y, const Gempyre::Bitmap& bmp) {
      if(bmp.m_canvas)
         paint(bmp.m_canvas, x, y, true);
 }
+
+namespace {
+    using Cmd = CanvasElement::Command;
+
+    struct DrawOp {
+        std::string name;
+        CanvasElement::CommandList args;
+        bool removed = false;
+    };
+
+    // numbers of arguments of each command the canvasDraw in gempyre.js understands
+    const std::unordered_map<std::string_view, unsigned> CommandArity {
+        {"strokeRect", 4}, {"clearRect", 4}, {"fillRect", 4}, {"fillText", 3}, {"strokeText", 3},
+        {"arc", 5}, {"ellipse", 7}, {"beginPath", 0}, {"closePath", 0}, {"lineTo", 2}, {"moveTo", 2},
+        {"bezierCurveTo", 6}, {"quadraticCurveTo", 4}, {"arcTo", 5}, {"rect", 4}, {"stroke", 0}, {"fill", 0},
+        {"fillStyle", 1}, {"strokeStyle", 1}, {"lineWidth", 1}, {"font", 1}, {"textAlign", 1}, {"textBaseline", 1},
+        {"save", 0}, {"restore", 0}, {"rotate", 1}, {"translate", 2}, {"scale", 2},
+        {"drawImage", 3}, {"drawImageRect", 5}, {"drawImageClip", 9}, {"reset", 0}};
+
+    // state that the pass tracks, other state (transforms, paths) is not affected by these
+    constexpr std::string_view StateNames[] {"fillStyle", "strokeStyle", "lineWidth", "font", "textAlign", "textBaseline"};
+    constexpr auto StateCount = std::size(StateNames);
+
+    std::optional<unsigned> state_index(const std::string& name) {
+        for(auto i = 0U; i < StateCount; ++i)
+            if(StateNames[i] == name)
+                return i;
+        return std::nullopt;
+    }
+
+    std::optional<double> number(const Cmd& cmd) {
+        if(const auto doubleval = std::get_if<double>(&cmd))
+            return *doubleval;
+        if(const auto intval = std::get_if<int>(&cmd))
+            return static_cast<double>(*intval);
+        return std::nullopt;
+    }
+
+    bool same_value(const Cmd& a, const Cmd& b) {
+        const auto na = number(a);
+        const auto nb = number(b);
+        if(na && nb)
+            return *na == *nb;
+        return a == b;
+    }
+
+    // if rectangles share a full edge, return them as a one rectangle
+    std::optional<std::array<double, 4>> join_rects(const CanvasElement::CommandList& a, const CanvasElement::CommandList& b) {
+        std::array<double, 4> ra, rb;
+        for(auto i = 0U; i < 4; ++i) {
+            const auto va = number(a[i]);
+            const auto vb = number(b[i]);
+            if(!va || !vb)
+                return std::nullopt;
+            ra[i] = *va;
+            rb[i] = *vb;
+        }
+        if(ra[2] <= 0 || ra[3] <= 0 || rb[2] <= 0 || rb[3] <= 0)
+            return std::nullopt;
+        if(ra[1] == rb[1] && ra[3] == rb[3]) {
+            if(ra[0] + ra[2] == rb[0])
+                return std::array<double, 4>{ra[0], ra[1], ra[2] + rb[2], ra[3]};
+            if(rb[0] + rb[2] == ra[0])
+                return std::array<double, 4>{rb[0], ra[1], ra[2] + rb[2], ra[3]};
+        }
+        if(ra[0] == rb[0] && ra[2] == rb[2]) {
+            if(ra[1] + ra[3] == rb[1])
+                return std::array<double, 4>{ra[0], ra[1], ra[2], ra[3] + rb[3]};
+            if(rb[1] + rb[3] == ra[1])
+                return std::array<double, 4>{ra[0], rb[1], ra[2], ra[3] + rb[3]};
+        }
+        return std::nullopt;
+    }
+
+    Cmd as_command(double value, bool as_int) {
+        if(as_int)
+            return static_cast<int>(value);
+        return value;
+    }
+}
+
+std::size_t FrameComposer::optimize() {
+    std::vector<DrawOp> ops;
+    for(auto pos = 0U; pos < m_composition.size();) {
+        const auto name = std::get_if<std::string>(&m_composition[pos]);
+        if(!name)
+            return 0;
+        const auto arity = CommandArity.find(*name);
+        if(arity == CommandArity.end() || pos + 1 + arity->second > m_composition.size()) {
+            GempyreUtils::log(GempyreUtils::LogLevel::Debug, "Frame not optimized, cannot parse", *name);
+            return 0;
+        }
+        const auto begin = m_composition.begin() + pos + 1;
+        ops.push_back(DrawOp{*name, {begin, begin + arity->second}});
+        pos += 1 + arity->second;
+    }
+
+    using State = std::array<std::optional<Cmd>, StateCount>;
+    constexpr auto NoOp = std::numeric_limits<std::size_t>::max();
+    struct Saved {State state; std::size_t save_op; std::size_t live; std::size_t last_live;};
+
+    State state{};                      // unknown until set
+    std::vector<Saved> stack;
+    std::array<std::size_t, StateCount> unused_set;  // sets not yet used by any other command
+    unused_set.fill(NoOp);
+    std::size_t live = 0;               // ops that are currently not removed
+    std::size_t last_live = NoOp;
+
+    const auto remove = [&](std::size_t index) {
+        ops[index].removed = true;
+        --live;
+    };
+
+    const auto clear_unused = [&]() {unused_set.fill(NoOp);};
+
+    for(auto i = 0U; i < ops.size(); ++i) {
+        auto& op = ops[i];
+        ++live;
+        if(const auto index = state_index(op.name)) {
+            const auto& value = op.args.front();
+            if(state[*index] && same_value(*state[*index], value)) {
+                remove(i);
+                continue;
+            }
+            if(unused_set[*index] != NoOp)
+                remove(unused_set[*index]); // overridden before use
+            state[*index] = value;
+            unused_set[*index] = i;
+        } else if(op.name == "save") {
+            clear_unused();
+            stack.push_back(Saved{state, i, live, last_live});
+        } else if(op.name == "restore") {
+            if(stack.empty()) {
+                // restores something not seen here
+                state = State{};
+                clear_unused();
+            } else {
+                // anything set after save and not used is dropped by restore
+                for(auto& u : unused_set)
+                    if(u != NoOp)
+                        remove(u);
+                clear_unused();
+                const auto saved = stack.back();
+                stack.pop_back();
+                state = saved.state;
+                if(live == saved.live + 1) { // only save and this restore
+                    remove(saved.save_op);
+                    remove(i);
+                    last_live = saved.last_live;
+                    continue;
+                }
+            }
+        } else if(op.name == "reset") {
+            state = State{};
+            stack.clear();
+            clear_unused();
+        } else {
+            clear_unused();
+            if((op.name == "fillRect" || op.name == "clearRect") && last_live != NoOp) {
+                auto& prev = ops[last_live];
+                if(!prev.removed && prev.name == op.name) {
+                    if(const auto joined = join_rects(prev.args, op.args)) {
+                        const auto as_int = std::all_of(prev.args.begin(), prev.args.end(), [](const auto& a) {return std::holds_alternative<int>(a);})
+                                && std::all_of(op.args.begin(), op.args.end(), [](const auto& a) {return std::holds_alternative<int>(a);});
+                        for(auto a = 0U; a < 4; ++a)
+                            prev.args[a] = as_command((*joined)[a], as_int);
+                        remove(i);
+                        continue;
+                    }
+                }
+            }
+        }
+        last_live = i;
+    }
+
+    const auto removed = ops.size() - live;
+    if(removed == 0)
+        return 0;
+    CanvasElement::CommandList composition;
+    composition.reserve(m_composition.size());
+    for(auto& op : ops) {
+        if(op.removed)
+            continue;
+        composition.emplace_back(std::move(op.name));
+        std::move(op.args.begin(), op.args.end(), std::back_inserter(composition));
+    }
+    m_composition = std::move(composition);
+    return removed;
+}
+
+// rows with changes are grouped to bands, a band is split when there are more unchanged rows in between
+static constexpr auto LayerBandGap = 16;
+
+static std::vector<Rect> changed_areas(const CanvasData& current, const CanvasData& presented) {
+    std::vector<Rect> areas;
+    const auto width = current.width();
+    int first_row = -1, last_row = -1, left = width, right = -1;
+    const auto close_band = [&]() {
+        if(first_row >= 0)
+            areas.push_back(Rect{left, first_row, right - left + 1, last_row - first_row + 1});
+        first_row = -1;
+        left = width;
+        right = -1;
+    };
+    for(auto y = 0; y < current.height(); ++y) {
+        const auto row = current.data() + y * width;
+        const auto prev = presented.data() + y * width;
+        if(std::equal(row, row + width, prev))
+            continue;
+        if(first_row >= 0 && y - last_row > LayerBandGap)
+            close_band();
+        if(first_row < 0)
+            first_row = y;
+        last_row = y;
+        const auto diff = std::mismatch(row, row + width, prev);
+        left = std::min(left, static_cast<int>(diff.first - row));
+        const auto rdiff = std::mismatch(std::make_reverse_iterator(row + width), std::make_reverse_iterator(row), std::make_reverse_iterator(prev + width));
+        right = std::max(right, width - 1 - static_cast<int>(rdiff.first - std::make_reverse_iterator(row + width)));
+    }
+    close_band();
+    return areas;
+}
+
+static void copy_area(const CanvasData& source, const Rect& area, CanvasData& target, int x, int y) {
+    for(auto row = 0; row < area.height; ++row) {
+        const auto line = source.data() + area.x + (area.y + row) * source.width();
+        std::copy(line, line + area.width, target.data() + x + (y + row) * target.width());
+    }
+}
+
+CanvasLayers::CanvasLayers(Ui& ui, const Element& parent, int width, int height, int layers)
+        : Element(ui, "div", parent) {
+    create_layers(width, height, layers);
+}
+
+CanvasLayers::CanvasLayers(Ui& ui, std::string_view id, const Element& parent, int width, int height, int layers)
+        : Element(ui, id, "div", parent) {
+    create_layers(width, height, layers);
+}
+
+CanvasLayers::~CanvasLayers() {}
+
+void CanvasLayers::create_layers(int width, int height, int layers) {
+    gempyre_utils_assert_x((width > 0 && height > 0 && layers > 0), "Invalid layers");
+    m_layers = std::make_shared<Layers>();
+    m_layers->width = width;
+    m_layers->height = height;
+    set_attribute("style", "position:relative;width:" + std::to_string(width) + "px;height:" + std::to_string(height) + "px");
+    for(auto i = 0; i < layers; ++i) {
+        CanvasElement canvas(*m_ui, *this);
+        canvas.set_attribute("width", std::to_string(width));
+        canvas.set_attribute("height", std::to_string(height));
+        canvas.set_attribute("style", "position:absolute;left:0;top:0;z-index:" + std::to_string(i));
+        m_layers->canvases.push_back(std::move(canvas));
+        m_layers->bitmaps.emplace_back(width, height);
+        m_layers->presented.emplace_back();
+    }
+    m_layers->commit = std::make_shared<CanvasData>(1, 1, m_id);
+    ref().send(*this, "canvas_layers", layers);
+}
+
+int CanvasLayers::count() const {
+    return static_cast<int>(m_layers->bitmaps.size());
+}
+
+int CanvasLayers::width() const {
+    return m_layers->width;
+}
+
+int CanvasLayers::height() const {
+    return m_layers->height;
+}
+
+Bitmap& CanvasLayers::layer(int index) {
+    gempyre_utils_assert_x((index >= 0 && index < count()), "Invalid layer");
+    return m_layers->bitmaps[static_cast<size_t>(index)];
+}
+
+CanvasElement CanvasLayers::canvas(int index) const {
+    gempyre_utils_assert_x((index >= 0 && index < count()), "Invalid layer");
+    return m_layers->canvases[static_cast<size_t>(index)];
+}
+
+void CanvasLayers::invalidate(int index) {
+    gempyre_utils_assert_x((index >= 0 && index < count()), "Invalid layer");
+    m_layers->presented[static_cast<size_t>(index)].reset();
+}
+
+size_t CanvasLayers::present() {
+    size_t sent = 0;
+    for(auto i = 0U; i < m_layers->bitmaps.size(); ++i) {
+        const auto& current = m_layers->bitmaps[i].m_canvas;
+        if(!current)
+            continue;
+        auto& presented = m_layers->presented[i];
+        std::vector<Rect> areas;
+        if(!presented || presented->width() != current->width() || presented->height() != current->height()) {
+            presented = std::make_shared<CanvasData>(current->width(), current->height());
+            areas.push_back(Rect{0, 0, current->width(), current->height()});
+        } else {
+            areas = changed_areas(*current, *presented);
+        }
+        for(const auto& area : areas) {
+            auto tile = std::make_shared<CanvasData>(area.width, area.height);
+            copy_area(*current, area, *tile, 0, 0);
+            copy_area(*current, area, *presented, area.x, area.y);
+            m_layers->canvases[i].paint(tile, area.x, area.y, false, StagedFlag);
+        }
+        sent += areas.size();
+    }
+    if(sent == 0)
+        return 0; // nothing staged, a commit would only be a redundant draw
+    // commit goes in the same binary queue after the staged tiles
+    m_layers->commit->ref().writeHeader({0, 0, 0, 0, CommitFlag | AsDrawFlag});
+    ref().send(m_layers->commit->ptr(), false);
+    GempyreUtils::log(GempyreUtils::LogLevel::Debug, "Layers presented", m_id, sent);
+    return sent;
+}
+
+void CanvasLayers::draw_completed(const CanvasElement::DrawCallback& drawCallback, CanvasElement::DrawNotify kick) {
+    ref().send(*this, "event_notify",
+        "name", "canvas_draw",
+        "add", drawCallback != nullptr);
+
+    if (drawCallback) {
+        if(kick == CanvasElement::DrawNotify::Kick) {
+            ui().after(0ms, drawCallback);
+        }
+        subscribe("event_notify", [drawCallback](const Event& ev) {
+            if(ev.properties.at("name") == "canvas_draw") {
+                drawCallback();
+            }
+        });
+    }
+}
@@ -0,0 +1,179 @@
+#ifndef INPUT_QUEUE_H
+#define INPUT_QUEUE_H
+
+#include "gempyre.h"
+#include "server.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <optional>
+#include <unordered_map>
+#include <algorithm>
+#include <mutex>
+#include <cstdint>
+
+namespace Gempyre {
+
+// Events received from UI waiting for their handlers. Events of a subscription that has a coalescing policy are
+// merged while they wait, so a handler that falls behind gets the latest state instead of a growing backlog.
+class InputQueue {
+public:
+    using Coalesce = Element::Coalesce;
+
+    struct Event {
+        std::string element;
+        std::string handler;
+        Server::Object data;
+    };
+
+    void set_policy(const std::string& element, const std::string& handler, Coalesce coalesce, const std::vector<std::string>& deltas = {}) {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        const auto k = key(element, handler);
+        if(coalesce == Coalesce::None)
+            m_policies.erase(k);
+        else
+            m_policies[k] = Policy{coalesce, deltas};
+        m_waiting.erase(k); // a policy change does not merge into earlier events
+    }
+
+    void push(Event&& event) {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        if(!m_policies.empty()) {
+            auto k = key(event.element, event.handler);
+            const auto policy = m_policies.find(k);
+            if(policy != m_policies.end()) {
+                const auto waiting = m_waiting.find(k);
+                if(waiting != m_waiting.end() && merge(policy->second, waiting->second, event))
+                    return;
+                m_waiting[k] = Waiting{m_base + m_events.size(), std::nullopt};
+                m_events.push_back(Entry{std::move(k), std::move(event)});
+                m_maxSize = std::max(m_maxSize, m_events.size());
+                return;
+            }
+        }
+        m_events.push_back(Entry{{}, std::move(event)});
+        m_maxSize = std::max(m_maxSize, m_events.size());
+    }
+
+    // oldest event, queue must not be empty
+    Event take() {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        auto entry = std::move(m_events.front());
+        m_events.pop_front();
+        if(!entry.key.empty()) {
+            const auto waiting = m_waiting.find(entry.key);
+            if(waiting != m_waiting.end() && waiting->second.first == m_base) {
+                if(waiting->second.last)
+                    waiting->second = Waiting{*waiting->second.last, std::nullopt};
+                else
+                    m_waiting.erase(waiting);
+            }
+        }
+        ++m_base;
+        return std::move(entry.event);
+    }
+
+    bool empty() const {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        return m_events.empty();
+    }
+
+    size_t size() const {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        return m_events.size();
+    }
+
+    size_t max_size() const {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        return m_maxSize;
+    }
+
+    size_t coalesced() const {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        return m_coalesced;
+    }
+
+    void clear() {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        m_base += m_events.size();
+        m_events.clear();
+        m_waiting.clear();
+    }
+
+private:
+    struct Policy {
+        Coalesce coalesce{Coalesce::None};
+        std::vector<std::string> deltas{};
+    };
+
+    // queue positions of the waiting events of a subscription
+    struct Waiting {
+        uint64_t first{0};
+        std::optional<uint64_t> last{};
+    };
+
+    struct Entry {
+        std::string key;    // empty if not coalesced
+        Event event;
+    };
+
+    // ids have no spaces
+    static std::string key(const std::string& element, const std::string& handler) {
+        return element + ' ' + handler;
+    }
+
+    Event& at(uint64_t position) {
+        return m_events[static_cast<size_t>(position - m_base)].event;
+    }
+
+    // returns false if event has to be queued
+    bool merge(const Policy& policy, Waiting& waiting, Event& event) {
+        switch(policy.coalesce) {
+        case Coalesce::Latest:
+            at(waiting.first).data = std::move(event.data);
+            break;
+        case Coalesce::FirstAndLast:
+            if(!waiting.last) {
+                waiting.last = m_base + m_events.size();
+                m_events.push_back(Entry{key(event.element, event.handler), std::move(event)});
+                m_maxSize = std::max(m_maxSize, m_events.size());
+                return true;
+            }
+            at(*waiting.last).data = std::move(event.data);
+            break;
+        case Coalesce::Accumulate: {
+            auto& data = at(waiting.first).data;
+            for(const auto& delta : policy.deltas) {
+                const auto previous = data.find(delta);
+                const auto current = event.data.find(delta);
+                if(previous == data.end() || current == event.data.end() ||
+                    !previous->second.is_number() || !current->second.is_number())
+                    continue;
+                // integers stay integers, so the string view of event properties does not change form
+                if(previous->second.is_number_integer() && current->second.is_number_integer())
+                    current->second = previous->second.get<int64_t>() + current->second.get<int64_t>();
+                else
+                    current->second = previous->second.get<double>() + current->second.get<double>();
+            }
+            data = std::move(event.data);
+            } break;
+        default:
+            return false;
+        }
+        ++m_coalesced;
+        return true;
+    }
+
+private:
+    mutable std::mutex m_mutex{};
+    std::deque<Entry> m_events{};
+    uint64_t m_base{0}; // position of the front event
+    std::unordered_map<std::string, Policy> m_policies{};
+    std::unordered_map<std::string, Waiting> m_waiting{};
+    size_t m_maxSize{0};
+    size_t m_coalesced{0};
+};
+
+}
+
+#endif // INPUT_QUEUE_H
@@ -0,0 +1,618 @@
+#include "gempyre_pyramid.h"
+#include "gempyre_utils.h"
+#include "canvas_data.h"
+#include "data.h"
+#include "gempyre_internal.h"
+#include <fstream>
+#include <cmath>
+#include <cstring>
+#include <array>
+#include <algorithm>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef WINDOWS_OS
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace Gempyre;
+
+// file layout: header, level table, level tiles from level 0 up
+static constexpr char PyramidMagic[4] = {'G', 'P', 'Y', 'R'};
+static constexpr uint32_t PyramidVersion = 1;
+static constexpr int MaxLevels = 32;
+static constexpr uint64_t DataAlign = 64;
+
+static constexpr auto PumpInterval = 16ms;           // retry when connection is busy
+static constexpr size_t PumpBacklog = 1024 * 1024;   // bytes buffered or queued before tiles wait
+static constexpr size_t PumpMaxTiles = 32;           // tiles sent in one go
+static constexpr int PrefetchDepth = 1;              // tiles ahead along the pan direction
+
+namespace {
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t tile_size;
+    uint32_t levels;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct LevelInfo {
+    uint64_t offset;
+    uint32_t width;
+    uint32_t height;
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+};
+
+static_assert(sizeof(Header) == 24 && sizeof(LevelInfo) == 24, "Packed layout expected");
+
+uint64_t tile_bytes(uint32_t tile_size) {
+    return static_cast<uint64_t>(tile_size) * tile_size * sizeof(dataT);
+}
+
+std::vector<LevelInfo> level_table(uint32_t width, uint32_t height, uint32_t tile_size) {
+    std::vector<LevelInfo> levels;
+    auto offset = sizeof(Header) + MaxLevels * sizeof(LevelInfo);
+    offset = (offset + DataAlign - 1) / DataAlign * DataAlign;
+    for(;;) {
+        const auto tiles_x = (width + tile_size - 1) / tile_size;
+        const auto tiles_y = (height + tile_size - 1) / tile_size;
+        levels.push_back({offset, width, height, tiles_x, tiles_y});
+        offset += static_cast<uint64_t>(tiles_x) * tiles_y * tile_bytes(tile_size);
+        if((width <= tile_size && height <= tile_size) || levels.size() == MaxLevels)
+            break;
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+    return levels;
+}
+
+bool read_tile(std::fstream& file, const LevelInfo& level, uint32_t tile_size, uint32_t x, uint32_t y, std::vector<dataT>& tile) {
+    if(x >= level.tiles_x || y >= level.tiles_y)
+        return false;
+    file.seekg(static_cast<std::streamoff>(level.offset + (static_cast<uint64_t>(y) * level.tiles_x + x) * tile_bytes(tile_size)));
+    file.read(reinterpret_cast<char*>(tile.data()), static_cast<std::streamsize>(tile_bytes(tile_size)));
+    return static_cast<bool>(file);
+}
+
+// 2x2 box filter of the previous level
+void downscale_level(std::fstream& file, const LevelInfo& source, const LevelInfo& level, uint32_t tile_size) {
+    const auto tile_pixels = static_cast<size_t>(tile_size) * tile_size;
+    std::array<std::vector<dataT>, 4> sources;
+    std::array<bool, 4> exists{};
+    for(auto& s : sources)
+        s.resize(tile_pixels);
+    std::vector<dataT> tile(tile_pixels);
+    for(auto ty = 0U; ty < level.tiles_y; ++ty) {
+        for(auto tx = 0U; tx < level.tiles_x; ++tx) {
+            for(auto i = 0U; i < 4; ++i)
+                exists[i] = read_tile(file, source, tile_size, tx * 2 + (i & 1), ty * 2 + (i >> 1), sources[i]);
+            file.clear();
+            for(auto py = 0U; py < tile_size; ++py) {
+                for(auto px = 0U; px < tile_size; ++px) {
+                    dataT r = 0, g = 0, b = 0, a = 0, count = 0;
+                    const auto x = tx * tile_size + px;
+                    const auto y = ty * tile_size + py;
+                    if(x >= level.width || y >= level.height) { // padding
+                        tile[px + py * tile_size] = 0;
+                        continue;
+                    }
+                    for(auto sy = y * 2; sy < std::min(y * 2 + 2, source.height); ++sy) {
+                        for(auto sx = x * 2; sx < std::min(x * 2 + 2, source.width); ++sx) {
+                            const auto index = (sx / tile_size - tx * 2) + (sy / tile_size - ty * 2) * 2;
+                            if(!exists[index])
+                                continue;
+                            const auto pixel = sources[index][(sx % tile_size) + (sy % tile_size) * tile_size];
+                            r += Color::r(pixel);
+                            g += Color::g(pixel);
+                            b += Color::b(pixel);
+                            a += Color::alpha(pixel);
+                            ++count;
+                        }
+                    }
+                    tile[px + py * tile_size] = count > 0 ? Color::rgba(r / count, g / count, b / count, a / count) : 0;
+                }
+            }
+            file.seekp(static_cast<std::streamoff>(level.offset + (static_cast<uint64_t>(ty) * level.tiles_x + tx) * tile_bytes(tile_size)));
+            file.write(reinterpret_cast<const char*>(tile.data()), static_cast<std::streamsize>(tile_bytes(tile_size)));
+        }
+    }
+}
+}
+
+struct Pyramid::Mapping {
+    const uint8_t* data{nullptr};
+    uint64_t size{0};
+    Header header{};
+    std::vector<LevelInfo> levels{};
+#ifdef WINDOWS_OS
+    HANDLE file{INVALID_HANDLE_VALUE};
+    HANDLE mapping{nullptr};
+#else
+    int fd{-1};
+#endif
+
+    bool map(const std::string& path) {
+#ifdef WINDOWS_OS
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER file_size;
+        if(!GetFileSizeEx(file, &file_size))
+            return false;
+        size = static_cast<uint64_t>(file_size.QuadPart);
+        if(size == 0)
+            return false;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(!mapping)
+            return false;
+        data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        return data != nullptr;
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            return false;
+        struct stat st;
+        if(::fstat(fd, &st) != 0 || st.st_size <= 0)
+            return false;
+        size = static_cast<uint64_t>(st.st_size);
+        auto ptr = ::mmap(nullptr, static_cast<size_t>(size), PROT_READ, MAP_SHARED, fd, 0);
+        if(ptr == MAP_FAILED)
+            return false;
+        data = static_cast<const uint8_t*>(ptr);
+        return true;
+#endif
+    }
+
+    bool validate() {
+        if(size < sizeof(Header) + MaxLevels * sizeof(LevelInfo))
+            return false;
+        std::memcpy(&header, data, sizeof(Header));
+        if(std::memcmp(header.magic, PyramidMagic, sizeof(PyramidMagic)) != 0 || header.version != PyramidVersion)
+            return false;
+        if(header.tile_size == 0 || header.levels == 0 || header.levels > MaxLevels || header.width == 0 || header.height == 0)
+            return false;
+        levels.resize(header.levels);
+        std::memcpy(levels.data(), data + sizeof(Header), header.levels * sizeof(LevelInfo));
+        for(const auto& level : levels) {
+            const auto end = level.offset + static_cast<uint64_t>(level.tiles_x) * level.tiles_y * tile_bytes(header.tile_size);
+            if(level.offset % sizeof(dataT) != 0 || end > size
+                || level.tiles_x != (level.width + header.tile_size - 1) / header.tile_size
+                || level.tiles_y != (level.height + header.tile_size - 1) / header.tile_size)
+                return false;
+        }
+        return true;
+    }
+
+    ~Mapping() {
+#ifdef WINDOWS_OS
+        if(data)
+            UnmapViewOfFile(data);
+        if(mapping)
+            CloseHandle(mapping);
+        if(file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+#else
+        if(data)
+            ::munmap(const_cast<uint8_t*>(data), static_cast<size_t>(size));
+        if(fd >= 0)
+            ::close(fd);
+#endif
+    }
+};
+
+bool Pyramid::build(const std::string& path, int width, int height, const RowReader& reader, int tile_size) {
+    if(width <= 0 || height <= 0 || tile_size <= 0 || !reader) {
+        GempyreUtils::log(GempyreUtils::LogLevel::Error, "Invalid pyramid", width, height, tile_size);
+        return false;
+    }
+    const auto size = static_cast<uint32_t>(tile_size);
+    const auto levels = level_table(static_cast<uint32_t>(width), static_cast<uint32_t>(height), size);
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!file) {
+        GempyreUtils::log(GempyreUtils::LogLevel::Error, "Cannot write pyramid", path);
+        return false;
+    }
+
+    Header header{};
+    std::memcpy(header.magic, PyramidMagic, sizeof(PyramidMagic));
+    header.version = PyramidVersion;
+    header.tile_size = size;
+    header.levels = static_cast<uint32_t>(levels.size());
+    header.width = static_cast<uint32_t>(width);
+    header.height = static_cast<uint32_t>(height);
+    std::vector<LevelInfo> table(MaxLevels, LevelInfo{0, 0, 0, 0, 0});
+    std::copy(levels.begin(), levels.end(), table.begin());
+    file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+    file.write(reinterpret_cast<const char*>(table.data()), static_cast<std::streamsize>(table.size() * sizeof(LevelInfo)));
+
+    // level 0 a band of tile rows at the time
+    const auto& base = levels.front();
+    std::vector<dataT> band(static_cast<size_t>(width) * size);
+    std::vector<dataT> tile(static_cast<size_t>(size) * size);
+    file.seekp(static_cast<std::streamoff>(base.offset));
+    for(auto ty = 0U; ty < base.tiles_y; ++ty) {
+        const auto rows = std::min(size, base.height - ty * size);
+        for(auto row = 0U; row < rows; ++row) {
+            if(!reader(static_cast<int>(ty * size + row), band.data() + static_cast<size_t>(row) * width)) {
+                GempyreUtils::log(GempyreUtils::LogLevel::Error, "Pyramid row read failed", ty * size + row);
+                return false;
+            }
+        }
+        for(auto tx = 0U; tx < base.tiles_x; ++tx) {
+            const auto columns = std::min(size, base.width - tx * size);
+            std::fill(tile.begin(), tile.end(), 0);
+            for(auto row = 0U; row < rows; ++row)
+                std::memcpy(tile.data() + static_cast<size_t>(row) * size, band.data() + static_cast<size_t>(row) * width + tx * size, columns * sizeof(dataT));
+            file.write(reinterpret_cast<const char*>(tile.data()), static_cast<std::streamsize>(tile_bytes(size)));
+        }
+    }
+
+    for(auto i = 1U; i < levels.size(); ++i)
+        downscale_level(file, levels[i - 1], levels[i], size);
+
+    file.flush();
+    if(!file) {
+        GempyreUtils::log(GempyreUtils::LogLevel::Error, "Pyramid write failed", path);
+        return false;
+    }
+    GempyreUtils::log(GempyreUtils::LogLevel::Debug, "Pyramid built", path, levels.size());
+    return true;
+}
+
+bool Pyramid::build(const std::string& path, const Bitmap& bitmap, int tile_size) {
+    const auto data = bitmap.const_data();
+    const auto width = bitmap.width();
+    return build(path, width, bitmap.height(), [data, width](int y, Color::type* row) {
+        std::memcpy(row, data + static_cast<size_t>(y) * width * sizeof(Color::type), static_cast<size_t>(width) * sizeof(Color::type));
+        return true;
+    }, tile_size);
+}
+
+std::shared_ptr<Pyramid> Pyramid::open(const std::string& path) {
+    auto mapping = std::make_unique<Mapping>();
+    if(!mapping->map(path)) {
+        GempyreUtils::log(GempyreUtils::LogLevel::Error, "Cannot map pyramid", path);
+        return nullptr;
+    }
+    if(!mapping->validate()) {
+        GempyreUtils::log(GempyreUtils::LogLevel::Error, "Not a valid pyramid", path);
+        return nullptr;
+    }
+    return std::shared_ptr<Pyramid>(new Pyramid(std::move(mapping)));
+}
+
+Pyramid::Pyramid(std::unique_ptr<Mapping>&& mapping) : m_map{std::move(mapping)} {}
+
+Pyramid::~Pyramid() = default;
+
+int Pyramid::width() const {
+    return static_cast<int>(m_map->header.width);
+}
+
+int Pyramid::height() const {
+    return static_cast<int>(m_map->header.height);
+}
+
+int Pyramid::tile_size() const {
+    return static_cast<int>(m_map->header.tile_size);
+}
+
+int Pyramid::levels() const {
+    return static_cast<int>(m_map->levels.size());
+}
+
+int Pyramid::level_width(int level) const {
+    return level >= 0 && level < levels() ? static_cast<int>(m_map->levels[static_cast<size_t>(level)].width) : 0;
+}
+
+int Pyramid::level_height(int level) const {
+    return level >= 0 && level < levels() ? static_cast<int>(m_map->levels[static_cast<size_t>(level)].height) : 0;
+}
+
+int Pyramid::tiles_x(int level) const {
+    return level >= 0 && level < levels() ? static_cast<int>(m_map->levels[static_cast<size_t>(level)].tiles_x) : 0;
+}
+
+int Pyramid::tiles_y(int level) const {
+    return level >= 0 && level < levels() ? static_cast<int>(m_map->levels[static_cast<size_t>(level)].tiles_y) : 0;
+}
+
+const Color::type* Pyramid::tile(int level, int x, int y) const {
+    if(x < 0 || y < 0 || x >= tiles_x(level) || y >= tiles_y(level))
+        return nullptr;
+    const auto& info = m_map->levels[static_cast<size_t>(level)];
+    const auto offset = info.offset + (static_cast<uint64_t>(y) * info.tiles_x + static_cast<uint64_t>(x)) * tile_bytes(m_map->header.tile_size);
+    return reinterpret_cast<const Color::type*>(m_map->data + offset);
+}
+
+
+struct PyramidViewer::View : std::enable_shared_from_this<PyramidViewer::View> {
+    struct Tile {
+        int level;
+        int x;
+        int y;
+    };
+
+    View(const CanvasElement& element, GempyreInternal& gempyre, const std::shared_ptr<const Pyramid>& image, int w, int h, size_t cache_tiles)
+        : pyramid{image}, canvas{element}, internal{&gempyre}, width{w}, height{h}, capacity{cache_tiles} {}
+
+    std::shared_ptr<const Pyramid> pyramid;
+    CanvasElement canvas;
+    GempyreInternal* internal;
+    int width;
+    int height;
+    size_t capacity;
+    double x{0};
+    double y{0};
+    double zoom{1};
+    int level{0};
+    double motion_x{0};  // last pan in image pixels, prefetch direction
+    double motion_y{0};
+    std::list<std::string> lru{}; // tiles in the client cache, recently used first
+    std::unordered_map<std::string, std::list<std::string>::iterator> cached{};
+    std::unordered_set<std::string> pinned{}; // used in the current draw
+    std::vector<std::string> evicted{};       // not yet told to the client
+    std::deque<Tile> pending{};
+    bool pumping{false};
+
+    std::string key(const Tile& tile) const {
+        return canvas.id() + '/' + std::to_string(tile.level) + '/' + std::to_string(tile.x) + '/' + std::to_string(tile.y);
+    }
+
+    // view left, top in image pixels
+    double left() const {return x - width / (2 * zoom);}
+    double top() const {return y - height / (2 * zoom);}
+
+    int pick_level() const {
+        if(zoom >= 1)
+            return 0;
+        const auto l = static_cast<int>(std::floor(std::log2(1 / zoom)));
+        return std::clamp(l, 0, pyramid->levels() - 1);
+    }
+
+    // [key, sx, sy, sw, sh, dx, dy, dw, dh], see tileDraw in gempyre.js
+    json draw_entry(const Tile& tile) const {
+        const auto size = pyramid->tile_size();
+        const auto scale = static_cast<double>(1 << tile.level) * zoom;
+        const auto w = std::min(size, pyramid->level_width(tile.level) - tile.x * size);
+        const auto h = std::min(size, pyramid->level_height(tile.level) - tile.y * size);
+        const auto dx = (tile.x * size * static_cast<double>(1 << tile.level) - left()) * zoom;
+        const auto dy = (tile.y * size * static_cast<double>(1 << tile.level) - top()) * zoom;
+        return json::array({key(tile), 0, 0, w, h, dx, dy, w * scale, h * scale});
+    }
+
+    void touch(const std::string& k) {
+        const auto it = cached.find(k);
+        if(it != cached.end())
+            lru.splice(lru.begin(), lru, it->second);
+    }
+
+    void insert(const std::string& k) {
+        lru.push_front(k);
+        cached.emplace(k, lru.begin());
+        while(cached.size() > capacity && !pinned.count(lru.back())) {
+            evicted.push_back(lru.back());
+            cached.erase(lru.back());
+            lru.pop_back();
+        }
+    }
+
+    // closest lower resolution tile in the cache
+    std::optional<Tile> ancestor(const Tile& tile) const {
+        for(auto l = tile.level + 1; l < pyramid->levels(); ++l) {
+            const auto shift = l - tile.level;
+            const Tile parent{l, tile.x >> shift, tile.y >> shift};
+            if(cached.count(key(parent)))
+                return parent;
+        }
+        return std::nullopt;
+    }
+
+    void update() {
+        level = pick_level();
+        const auto span = pyramid->tile_size() * static_cast<double>(1 << level); // image pixels per tile
+        const auto x0 = static_cast<int>(std::floor(left() / span));
+        const auto y0 = static_cast<int>(std::floor(top() / span));
+        const auto x1 = static_cast<int>(std::floor((left() + width / zoom) / span));
+        const auto y1 = static_cast<int>(std::floor((top() + height / zoom) / span));
+        const auto tx0 = std::max(0, x0);
+        const auto ty0 = std::max(0, y0);
+        const auto tx1 = std::min(pyramid->tiles_x(level) - 1, x1);
+        const auto ty1 = std::min(pyramid->tiles_y(level) - 1, y1);
+
+        pinned.clear();
+        auto under = json::array();
+        auto over = json::array();
+        std::vector<Tile> missing;
+        for(auto ty = ty0; ty <= ty1; ++ty) {
+            for(auto tx = tx0; tx <= tx1; ++tx) {
+                const Tile tile{level, tx, ty};
+                const auto k = key(tile);
+                pinned.insert(k);
+                over.push_back(draw_entry(tile));
+                if(cached.count(k)) {
+                    touch(k);
+                    continue;
+                }
+                missing.push_back(tile);
+                if(const auto parent = ancestor(tile)) {
+                    const auto pk = key(*parent);
+                    if(pinned.insert(pk).second) {
+                        touch(pk);
+                        under.push_back(draw_entry(*parent));
+                    }
+                }
+            }
+        }
+
+        // center first
+        const auto cx = (tx0 + tx1) / 2.0;
+        const auto cy = (ty0 + ty1) / 2.0;
+        std::sort(missing.begin(), missing.end(), [cx, cy](const auto& a, const auto& b) {
+            return std::hypot(a.x - cx, a.y - cy) < std::hypot(b.x - cx, b.y - cy);
+        });
+
+        // ring ahead of the view along the pan direction
+        const auto dir_x = motion_x > 0 ? 1 : (motion_x < 0 ? -1 : 0);
+        const auto dir_y = motion_y > 0 ? 1 : (motion_y < 0 ? -1 : 0);
+        std::vector<Tile> prefetch;
+        if(tx0 <= tx1 && ty0 <= ty1 && (dir_x != 0 || dir_y != 0)) {
+            const auto px0 = dir_x < 0 ? tx0 - PrefetchDepth : tx0;
+            const auto px1 = dir_x > 0 ? tx1 + PrefetchDepth : tx1;
+            const auto py0 = dir_y < 0 ? ty0 - PrefetchDepth : ty0;
+            const auto py1 = dir_y > 0 ? ty1 + PrefetchDepth : ty1;
+            for(auto ty = std::max(0, py0); ty <= std::min(pyramid->tiles_y(level) - 1, py1); ++ty) {
+                for(auto tx = std::max(0, px0); tx <= std::min(pyramid->tiles_x(level) - 1, px1); ++tx) {
+                    const Tile tile{level, tx, ty};
+                    if((tx < tx0 || tx > tx1 || ty < ty0 || ty > ty1) && !cached.count(key(tile)))
+                        prefetch.push_back(tile);
+                }
+            }
+        }
+
+        // whatever was pending and is not needed anymore is cancelled
+        const auto cancelled = pending.size();
+        pending.assign(missing.begin(), missing.end());
+        pending.insert(pending.end(), prefetch.begin(), prefetch.end());
+        GempyreUtils::log(GempyreUtils::LogLevel::Debug, "Pyramid view", level, over.size(), missing.size(), prefetch.size(), cancelled);
+
+        for(auto& entry : over)
+            under.push_back(std::move(entry));
+        internal->send(canvas, "tile_draw", "tiles", under, "evict", evicted);
+        evicted.clear();
+        pump();
+    }
+
+    void send_tile(const Tile& tile, const std::string& k) {
+        const auto size = pyramid->tile_size();
+        const auto w = std::min(size, pyramid->level_width(tile.level) - tile.x * size);
+        const auto h = std::min(size, pyramid->level_height(tile.level) - tile.y * size);
+        const auto pixels = pyramid->tile(tile.level, tile.x, tile.y);
+        CanvasData data(w, h, k);
+        for(auto row = 0; row < h; ++row)
+            std::memcpy(data.data() + row * w, pixels + row * size, static_cast<size_t>(w) * sizeof(dataT));
+        data.ref().writeHeader({0, 0, static_cast<dataT>(w), static_cast<dataT>(h), CanvasData::CachedTileFlag});
+        internal->send(data.ptr(), false); // cache has to know what the client has, hence not droppable
+    }
+
+    // send pending tiles as fast as the connection drains them
+    void pump() {
+        size_t sent = 0;
+        while(!pending.empty() && sent < PumpMaxTiles) {
+            const auto pressure = internal->pressure();
+            if(pressure.buffered + pressure.queued > PumpBacklog)
+                break;
+            const auto tile = pending.front();
+            pending.pop_front();
+            const auto k = key(tile);
+            if(cached.count(k))
+                continue;
+            send_tile(tile, k);
+            insert(k);
+            ++sent;
+        }
+        if(!evicted.empty()) {
+            internal->send(canvas, "tile_draw", "evict", evicted);
+            evicted.clear();
+        }
+        if(!pending.empty() && !pumping) {
+            pumping = true;
+            canvas.ui().after(PumpInterval, [weak = weak_from_this()]() {
+                if(const auto view = weak.lock()) {
+                    view->pumping = false;
+                    view->pump();
+                }
+            });
+        }
+    }
+};
+
+PyramidViewer::PyramidViewer(const CanvasElement& canvas, const std::shared_ptr<const Pyramid>& pyramid, int width, int height, size_t cache_tiles)
+    : CanvasElement{canvas} {
+    gempyre_utils_assert_x(pyramid != nullptr, "Pyramid is null");
+    m_view = std::make_shared<View>(canvas, ref(), pyramid, width, height, std::max<size_t>(cache_tiles, 1));
+    fit();
+}
+
+PyramidViewer::~PyramidViewer() = default;
+
+void PyramidViewer::set_view(double x, double y, double zoom) {
+    if(!(zoom > 0)) {
+        GempyreUtils::log(GempyreUtils::LogLevel::Error, "Invalid zoom", zoom);
+        return;
+    }
+    auto& view = *m_view;
+    if(zoom == view.zoom) {
+        view.motion_x = x - view.x;
+        view.motion_y = y - view.y;
+    } else {
+        view.motion_x = view.motion_y = 0;
+    }
+    view.x = x;
+    view.y = y;
+    view.zoom = zoom;
+    view.update();
+}
+
+void PyramidViewer::pan(double dx, double dy) {
+    set_view(m_view->x - dx / m_view->zoom, m_view->y - dy / m_view->zoom, m_view->zoom);
+}
+
+void PyramidViewer::zoom(double factor, double canvas_x, double canvas_y) {
+    if(!(factor > 0))
+        return;
+    const auto& view = *m_view;
+    // image point under the canvas point
+    const auto ix = view.left() + canvas_x / view.zoom;
+    const auto iy = view.top() + canvas_y / view.zoom;
+    const auto scaled = view.zoom * factor;
+    set_view(ix - (canvas_x - view.width / 2.0) / scaled, iy - (canvas_y - view.height / 2.0) / scaled, scaled);
+}
+
+void PyramidViewer::fit() {
+    const auto& pyramid = *m_view->pyramid;
+    const auto zoom = std::min(static_cast<double>(m_view->width) / pyramid.width(), static_cast<double>(m_view->height) / pyramid.height());
+    set_view(pyramid.width() / 2.0, pyramid.height() / 2.0, zoom);
+}
+
+void PyramidViewer::resize(int width, int height) {
+    m_view->width = width;
+    m_view->height = height;
+    m_view->motion_x = m_view->motion_y = 0;
+    m_view->update();
+}
+
+double PyramidViewer::x() const {
+    return m_view->x;
+}
+
+double PyramidViewer::y() const {
+    return m_view->y;
+}
+
+double PyramidViewer::zoom() const {
+    return m_view->zoom;
+}
+
+int PyramidViewer::level() const {
+    return m_view->level;
+}
+
+size_t PyramidViewer::pending() const {
+    return m_view->pending.size();
+}
+
+size_t PyramidViewer::cached() const {
+    return m_view->cached.size();
+}
@@ -0,0 +1,129 @@
+#ifndef QUALITY_H
+#define QUALITY_H
+
+#include "gempyre_graphics.h"
+#include "server.h"
+#include <chrono>
+#include <optional>
+#include <algorithm>
+
+//Exposed for unittests, otherwise only used for graphics.cpp
+
+namespace Gempyre {
+
+// Picks a quality level for canvas bitmaps from the Ui socket pressure.
+// Levels go down a step at the time when send backlog grows and back up when it has been calm for a while.
+class QualityController {
+public:
+    using Level = CanvasElement::Quality;
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr auto DEGRADE_INTERVAL = std::chrono::milliseconds{200};   // let a change take effect before next one
+    static constexpr auto RECOVER_INTERVAL = std::chrono::milliseconds{1000};  // how long it has to be calm before recovery
+    static constexpr auto PROBE_INTERVAL = std::chrono::milliseconds{4000};    // recover even if capacity estimate says no
+    static constexpr auto FRAME_BUDGET = std::chrono::milliseconds{100};       // time a frame is allowed to take to drain
+    static constexpr auto MINIMAL_FRAME_INTERVAL = std::chrono::milliseconds{200}; // draw_completed pace on Minimal
+    static constexpr size_t MAX_FRAMES_BEHIND = 2;
+
+    // how many times smaller frame is on each level, see CanvasElement::paint
+    static constexpr size_t cost_divisor(Level level) {
+        switch(level) {
+        case Level::Full: return 1;
+        case Level::Reduced: return 4;  // half resolution
+        case Level::Lossy: return 8;    // half resolution, 16 bit pixels
+        case Level::Minimal: return 32; // quarter resolution, 16 bit pixels
+        }
+        return 1;
+    }
+
+    // scale down factor of a level
+    static constexpr int scale(Level level) {
+        return level == Level::Minimal ? 4 : (level == Level::Full ? 1 : 2);
+    }
+
+    // is RGB565 used
+    static constexpr bool packed(Level level) {
+        return level == Level::Lossy || level == Level::Minimal;
+    }
+
+    // frame_bytes is the size of the frame at full quality
+    Level update(const Server::Pressure& pressure, size_t frame_bytes, Clock::time_point now) {
+        measure(pressure, now);
+        const auto backlog = pressure.buffered + pressure.queued;
+        const auto level_bytes = std::max<size_t>(1, frame_bytes / cost_divisor(m_level));
+        const auto budget = std::chrono::duration<double>(FRAME_BUDGET).count();
+
+        const auto slow = m_capacity && *m_capacity > 0
+                ? static_cast<double>(backlog) / *m_capacity > budget * MAX_FRAMES_BEHIND
+                : backlog > level_bytes * MAX_FRAMES_BEHIND;
+        if(slow) {
+            m_calmSince.reset();
+            if(m_level != Level::Minimal && now - m_changed >= DEGRADE_INTERVAL)
+                change(static_cast<Level>(static_cast<int>(m_level) + 1), now);
+            return m_level;
+        }
+
+        if(backlog > level_bytes / 2) {
+            m_calmSince.reset();
+            return m_level;
+        }
+
+        if(!m_calmSince)
+            m_calmSince = now;
+        const auto calm = now - std::max(*m_calmSince, m_changed);
+        if(m_level != Level::Full && calm >= RECOVER_INTERVAL) {
+            const auto next = static_cast<Level>(static_cast<int>(m_level) - 1);
+            const auto fits = !m_capacity || static_cast<double>(frame_bytes / cost_divisor(next)) <= *m_capacity * budget;
+            if(fits || calm >= PROBE_INTERVAL) {
+                if(!fits)
+                    m_capacity.reset(); // estimate was stale
+                change(next, now);
+            }
+        }
+        return m_level;
+    }
+
+    [[nodiscard]] Level level() const {return m_level;}
+
+    // estimated bytes per second the socket can drain
+    [[nodiscard]] std::optional<double> capacity() const {return m_capacity;}
+
+private:
+    void change(Level level, Clock::time_point now) {
+        m_level = level;
+        m_changed = now;
+    }
+
+    void measure(const Server::Pressure& pressure, Clock::time_point now) {
+        if(!m_previous || pressure.written < m_previous->written) { // first or a new connection
+            m_previous = pressure;
+            m_previousTime = now;
+            return;
+        }
+        const auto dt = std::chrono::duration<double>(now - m_previousTime).count();
+        if(dt < 0.01)
+            return;
+        const auto drained = static_cast<double>(pressure.written - m_previous->written)
+                + static_cast<double>(m_previous->buffered) - static_cast<double>(pressure.buffered);
+        const auto rate = std::max(0.0, drained) / dt;
+        const auto saturated = m_previous->buffered > 0 && pressure.buffered > 0;
+        if(saturated) // only then the rate tells what the connection can do
+            m_capacity = m_capacity ? 0.7 * *m_capacity + 0.3 * rate : rate;
+        else if(m_capacity && rate > *m_capacity)
+            m_capacity = rate;
+        m_previous = pressure;
+        m_previousTime = now;
+    }
+
+private:
+    Level m_level{Level::Full};
+    std::optional<Server::Pressure> m_previous{};
+    Clock::time_point m_previousTime{};
+    Clock::time_point m_changed{};
+    std::optional<Clock::time_point> m_calmSince{};
+    std::optional<double> m_capacity{};
+};
+
+}
+
+#endif // QUALITY_H
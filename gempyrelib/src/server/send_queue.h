@@ -0,0 +1,219 @@
+#ifndef SEND_QUEUE_H
+#define SEND_QUEUE_H
+
+#include "gempyre_types.h"
+#include "data.h"
+#include "server.h"
+#include <string>
+#include <string_view>
+#include <deque>
+#include <array>
+#include <chrono>
+#include <unordered_map>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+namespace Gempyre {
+
+// Outgoing messages of each socket in the order they were queued, text and binary alike. A message is
+// written in parts when the writer wants so, and the next message is not started before it is complete.
+// Messages are queued in lanes, the order is kept within a lane, and an interactive message is written
+// before the waiting bulk ones. Bulk gets its turn after a run of interactive messages, or when it has waited
+// too long. Socket is only used as a key, the writer does the actual sending.
+template <class Socket>
+class SendQueue {
+public:
+    using Lane = Server::Lane;
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t STARVATION_RUN = 32;                            // interactive messages bulk waits at most
+    static constexpr auto STARVATION_TIME = std::chrono::milliseconds{50};  // ...or this long
+    enum class Kind {Text, Packed, Data};
+
+    struct Message {
+        uint64_t seq{0};        // queue order, set by push
+        Kind kind{Kind::Text};
+        std::string text{};     // Text and Packed
+        DataPtr data{};         // Data
+        bool droppable{false};  // Data that can be skipped when socket is congested
+        size_t offset{0};       // bytes written
+        Lane lane{Lane::Interactive};
+        Clock::time_point queued{};
+
+        std::string_view payload() const {
+            if(kind != Kind::Data)
+                return text;
+            const auto& [bytes, len] = data->payload();
+            return {bytes, len};
+        }
+
+        size_t size() const {
+            return kind == Kind::Data ? data->size() : text.size();
+        }
+    };
+
+    // Result of writing a part of message
+    enum class Status {
+        Sent,           // part was written, more can be written
+        Backpressure,   // part was written, socket has to drain before more
+        Blocked,        // nothing was written, socket has to drain
+        Dropped         // nothing was written, message is kept
+    };
+
+    // Time from queueing to the first written part, running totals
+    struct Delay {
+        size_t messages{0};
+        std::chrono::microseconds total{0};
+        std::chrono::microseconds max{0};
+    };
+
+    uint64_t push(Socket* socket, std::string&& text, bool packed, Lane lane = Lane::Interactive) {
+        Message message;
+        message.kind = packed ? Kind::Packed : Kind::Text;
+        message.text = std::move(text);
+        message.lane = lane;
+        return push(socket, std::move(message));
+    }
+
+    uint64_t push(Socket* socket, const DataPtr& data, bool droppable, Lane lane = Lane::Interactive) {
+        Message message;
+        message.kind = Kind::Data;
+        message.data = data;
+        message.droppable = droppable;
+        message.lane = lane;
+        return push(socket, std::move(message));
+    }
+
+    // Writes messages of a socket, or all sockets if nullptr, until its queue is empty or writer cannot write more.
+    // writer(Socket*, Message&) writes the next part and advances offset, written(Socket*, Message&&) gets a written
+    // message and resend(Socket*) is called when the writer dropped a part.
+    template <class Writer, class Written, class Resend>
+    void send(Socket* target, Writer&& writer, Written&& written, Resend&& resend) {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        for(auto& [socket, lanes] : m_queues) {
+            if(target && target != socket)
+                continue;
+            while(auto queue = next(lanes)) {
+                auto& message = queue->front();
+                const auto start = message.offset;
+                const auto status = writer(socket, message);
+                if(status == Status::Dropped) {
+                    resend(socket);
+                    break;
+                }
+                if(status == Status::Blocked) {
+                    reduce(lanes);
+                    break;
+                }
+                if(start == 0 && message.offset > 0)
+                    delayed(message);
+                if(message.offset >= message.size()) {
+                    const auto waiting = !lanes.queues[index(Lane::Bulk)].empty();
+                    lanes.run = message.lane == Lane::Bulk ? 0 : lanes.run + (waiting ? 1 : 0);
+                    written(socket, std::move(message));
+                    queue->pop_front();
+                }
+                if(status == Status::Backpressure) {
+                    reduce(lanes);
+                    break;
+                }
+            }
+        }
+    }
+
+    void remove(Socket* socket) {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        m_queues.erase(socket);
+    }
+
+    bool empty() const {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        return std::all_of(m_queues.begin(), m_queues.end(), [](const auto& q) {
+            return std::all_of(q.second.queues.begin(), q.second.queues.end(), [](const auto& l) {return l.empty();});});
+    }
+
+    // bytes waiting to be written
+    size_t queued() const {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        size_t bytes = 0;
+        for(const auto& [socket, lanes] : m_queues)
+            for(const auto& queue : lanes.queues)
+                for(const auto& message : queue)
+                    bytes += message.size() - message.offset;
+        return bytes;
+    }
+
+    size_t dropped() const {
+        return m_droppedMessages;
+    }
+
+    Delay delay(Lane lane) const {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        return m_delays[index(lane)];
+    }
+
+private:
+    static constexpr size_t LANES = 2;
+
+    struct Lanes {
+        std::array<std::deque<Message>, LANES> queues{};
+        size_t run{0}; // interactive messages written while bulk was waiting
+    };
+
+    static constexpr size_t index(Lane lane) {
+        return lane == Lane::Interactive ? 0 : 1;
+    }
+
+    uint64_t push(Socket* socket, Message&& message) {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        message.seq = ++m_seq;
+        message.queued = Clock::now();
+        m_queues[socket].queues[index(message.lane)].push_back(std::move(message));
+        return m_seq;
+    }
+
+    // a started message is completed first, then interactive unless bulk is starving
+    std::deque<Message>* next(Lanes& lanes) const {
+        auto& interactive = lanes.queues[index(Lane::Interactive)];
+        auto& bulk = lanes.queues[index(Lane::Bulk)];
+        if(bulk.empty())
+            return interactive.empty() ? nullptr : &interactive;
+        if(interactive.empty() || bulk.front().offset > 0)
+            return &bulk;
+        if(interactive.front().offset > 0)
+            return &interactive;
+        const auto starving = lanes.run >= STARVATION_RUN ||
+            (lanes.run > 0 && Clock::now() - bulk.front().queued >= STARVATION_TIME);
+        return starving ? &bulk : &interactive;
+    }
+
+    void delayed(const Message& message) {
+        const auto delay = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - message.queued);
+        auto& d = m_delays[index(message.lane)];
+        ++d.messages;
+        d.total += delay;
+        d.max = std::max(d.max, delay);
+    }
+
+    // congested socket skips droppable messages, a started one is completed
+    void reduce(Lanes& lanes) {
+        for(auto& queue : lanes.queues) {
+            const auto it = std::remove_if(queue.begin(), queue.end(), [](const auto& m) {
+                return m.droppable && m.offset == 0;});
+            m_droppedMessages += static_cast<size_t>(std::distance(it, queue.end()));
+            queue.erase(it, queue.end());
+        }
+    }
+
+private:
+    mutable std::mutex m_mutex{};
+    std::unordered_map<Socket*, Lanes> m_queues{};
+    uint64_t m_seq{0};
+    std::atomic<size_t> m_droppedMessages{0};
+    std::array<Delay, LANES> m_delays{};
+};
+
+}
+
+#endif // SEND_QUEUE_H
@@ -1,11 +1,45 @@
 #include "server.h"
 #include "gempyre_utils.h"
+#include <algorithm>
 
 using namespace Gempyre;
 
 constexpr unsigned short DEFAULT_PORT  = 30000;
 constexpr unsigned short PORT_ATTEMPTS = 50;
 
+// UI sends pointer samples as binary, see sendPointers in gempyre.js: little endian uint32 type, sample count,
+// id length, id padded to four bytes and the samples
+constexpr uint32_t POINTER_STREAM_ID = 0xB01;
+constexpr size_t POINTER_HEADER = 12;
+constexpr size_t POINTER_SAMPLE_SIZE = 32;
+
+static uint32_t word(std::string_view message, size_t pos) {
+    uint32_t value = 0;
+    for(auto i = 0U; i < 4; ++i)
+        value |= static_cast<uint32_t>(static_cast<uint8_t>(message[pos + i])) << (8 * i);
+    return value;
+}
+
+// as a message of type pointer_stream, samples are kept binary
+std::optional<Server::Object> Server::pointerStream(std::string_view message) {
+    if(message.size() < POINTER_HEADER || word(message, 0) != POINTER_STREAM_ID)
+        return std::nullopt;
+    const auto count = word(message, 4);
+    const auto idLen = word(message, 8);
+    const auto samplesOffset = POINTER_HEADER + ((static_cast<size_t>(idLen) + 3) & ~size_t{3});
+    if(samplesOffset > message.size() ||
+        message.size() - samplesOffset != static_cast<size_t>(count) * POINTER_SAMPLE_SIZE) {
+        GempyreUtils::log(GempyreUtils::LogLevel::Error, "Invalid pointer stream", message.size(), count, idLen);
+        return Server::Object{};
+    }
+    const auto samples = message.substr(samplesOffset);
+    return Server::Object{
+        {"type", "event"},
+        {"element", std::string{message.substr(POINTER_HEADER, idLen)}},
+        {"event", Server::POINTER_STREAM},
+        {"properties", Server::Object{{"samples", json::binary_t{std::vector<uint8_t>(samples.begin(), samples.end())}}}}};
+}
+
  unsigned Server::wishAport(unsigned port, unsigned max) {
     auto end = port + max;
     while(!GempyreUtils::is_available(static_cast<unsigned short>(port))) {
@@ -81,8 +115,15 @@ Server::Server(
       <body><h1>Ooops</h1><h3 class="styled">404 Data Not Found </h3><h5>)" + std::string(url) + "</h5><i>" + std::string(info) + "</i></body></html>";
 }
 
-Server::MessageReply Server::messageHandler(std::string_view message) {
-        auto object = json::parse(message);
+Server::MessageReply Server::messageHandler(std::string_view message, bool packed) {
+        if(packed) {
+            if(auto pointers = pointerStream(message)) {
+                if(!pointers->empty())
+                    m_onMessage(std::move(*pointers));
+                return MessageReply::DoNothing;
+            }
+        }
+        auto object = packed ? json::from_msgpack(message) : json::parse(message);
         const auto f = object.find("type");
         GempyreUtils::log(GempyreUtils::LogLevel::Debug, "ServerMsg", f != object.end() ? *f : "N/A");
         if(f != object.end()) {
@@ -90,8 +131,11 @@ Server::MessageReply Server::messageHandler(std::string_view message) {
                 return MessageReply::DoNothing;
             }
             if(*f == "ui_ready") {
+                const auto encodings = object.find("encodings");
+                const auto can_pack = m_packed && encodings != object.end() && encodings->is_array()
+                    && std::find(encodings->begin(), encodings->end(), "msgpack") != encodings->end();
                 m_onMessage(std::move(object));
-                return MessageReply::AddUiSocket;
+                return can_pack ? MessageReply::AddPackedUiSocket : MessageReply::AddUiSocket;
             }
             if(*f == "extension_ready") {
                 m_onMessage(std::move(object));
@@ -11,6 +11,7 @@
 #include <string_view>
 #include <string>
 #include <atomic>
+#include <mutex>
 #include <cassert>
 #include <nlohmann/json.hpp>
 
@@ -40,6 +41,51 @@ public:
 
     enum class TargetSocket{Undefined, Ui, Extension, All};
 
+    // interactive messages are sent before bulk, see SendQueue and Ui::set_lane
+    enum class Lane {Interactive, Bulk};
+    static constexpr auto BINARY_TYPE = "binary";   // lane type of bitmaps
+    static constexpr auto POINTER_STREAM = "pointer_stream"; // event name of pointer samples, see Element::subscribe_pointer
+
+    // queueing delay of a lane, running totals
+    struct LaneDelay {
+        size_t messages{0};
+        size_t total_us{0};
+        size_t max_us{0};
+    };
+
+    // Ui socket send state, written is a running total
+    struct Pressure {
+        size_t buffered{0}; // bytes buffered in sockets
+        size_t queued{0};   // bytes waiting to be passed to sockets
+        size_t written{0};  // bytes passed to sockets
+    };
+
+    // Ui socket message counters, running totals
+    struct Traffic {
+        size_t messages_sent{0};
+        size_t bytes_sent{0};
+        size_t messages_received{0};
+        size_t bytes_received{0};
+        bool packed{false};  // Ui socket uses MessagePack
+        size_t coalesced{0}; // batched operations replaced by a later write
+        size_t compressed_messages{0};
+        size_t compressed_bytes{0};   // original size of compressed messages
+        double compression_ratio{1.0};  // sampled compressed size / original size
+        size_t compression_time_us{0};
+        size_t pulled_messages{0};  // fetched over http, see Uws_Server::notifyPulled
+        size_t pulled_bytes{0};
+        LaneDelay interactive{};
+        LaneDelay bulk{};
+    };
+
+    // permessage-deflate compression, see Ui::set_compression
+    struct Compression {
+        enum class Mode {Off, Text, All};  // Text compresses control messages, All bitmaps too
+        Mode mode{Mode::Off};
+        size_t min_size{1024};
+        int level{0};  // 0 is a shared compressor, 1 - 8 a dedicated compressor from 3kB to 256kB
+    };
+
     Server(unsigned int port,
            const std::string& rootFolder,
            const OpenFunction& onOpen,
@@ -72,6 +118,34 @@ public:
 
     virtual void flush() = 0;
 
+    virtual Pressure pressure() const = 0;
+    virtual Traffic traffic() const = 0;
+
+    // offer MessagePack to UIs that support it, otherwise JSON text is used
+    void setPacked(bool packed) {m_packed = packed;}
+
+    // message type to lane, types not set are interactive
+    void setLane(const std::string& type, Lane lane) {
+        const std::lock_guard<std::mutex> lock(m_laneMutex);
+        m_lanes[type] = lane;
+    }
+
+    Lane lane(const std::string& type) const {
+        const std::lock_guard<std::mutex> lock(m_laneMutex);
+        const auto it = m_lanes.find(type);
+        return it != m_lanes.end() ? it->second : Lane::Interactive;
+    }
+
+    // A bitmap stays in order with the DOM updates around it, unless it could be dropped anyway or bitmaps are set to bulk
+    Lane binaryLane(bool droppable) const {
+        const std::lock_guard<std::mutex> lock(m_laneMutex);
+        const auto it = m_lanes.find(BINARY_TYPE);
+        return it != m_lanes.end() ? it->second : (droppable ? Lane::Bulk : Lane::Interactive);
+    }
+
+    // pointer samples from UI as an event message, nullopt if not a pointer stream, empty if invalid
+    static std::optional<Object> pointerStream(std::string_view message);
+
     static unsigned wishAport(unsigned port, unsigned max);
     static unsigned portAttempts();
 
@@ -79,8 +153,8 @@ public:
     static std::string notFoundPage(const std::string_view& url, const std::string_view& info = "");
 
 protected:
-    enum class MessageReply {DoNothing, AddUiSocket, AddExtensionSocket};
-    MessageReply messageHandler(std::string_view message);
+    enum class MessageReply {DoNothing, AddUiSocket, AddPackedUiSocket, AddExtensionSocket};
+    MessageReply messageHandler(std::string_view message, bool packed);
 protected:
 
     unsigned int m_port;
@@ -91,6 +165,9 @@ protected:
     const CloseFunction m_onClose;
     const GetFunction m_onGet;
     const ListenFunction m_onListen;    
+    std::atomic_bool m_packed{true};
+    mutable std::mutex m_laneMutex{};
+    std::unordered_map<std::string, Lane> m_lanes{};
 };
 
 std::unique_ptr<Server> create_server(unsigned int port,
@@ -101,7 +178,8 @@ std::unique_ptr<Server> create_server(unsigned int port,
            const Server::GetFunction& onGet,
            const Server::ListenFunction& onListen,
            int queryIdBase,
-           const Server::ResendRequest& resendRequest);
+           const Server::ResendRequest& resendRequest,
+           const Server::Compression& compression);
 
 }
 
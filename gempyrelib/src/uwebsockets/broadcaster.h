@@ -5,13 +5,19 @@
 #include "gempyre_utils.h"
 #include "data.h"
 #include "server.h"
-#ifndef UWS_NO_ZLIB
-#define UWS_NO_ZLIB
-#endif
+#include "batch.h"
+#include "send_queue.h"
+// UWS_NO_ZLIB is defined when zlib is not available, then there is no compression
 
 #include <App.h>
+#ifndef UWS_NO_ZLIB
+#include <zlib.h>
+#endif
 
 #include <unordered_map>
+#include <unordered_set>
+#include <optional>
+#include <string_view>
 #include <cassert>
 
 using namespace std::chrono_literals;
@@ -23,20 +29,18 @@ using WSSocket = uWS::WebSocket<false, true, ExtraSocketData>;
 
 class Broadcaster {
     static constexpr auto DELAY = 100ms;
+    static constexpr size_t POOLED_BUFFERS = 4;
+    static constexpr size_t POOLED_MIN_SIZE = 4 * 1024;         // smaller are not worth of keeping
+    static constexpr size_t POOLED_MAX_SIZE = 2 * 1024 * 1024;  // larger are released
+    static constexpr size_t RATIO_SAMPLING = 16;                // every nth compressed message is measured
     static constexpr auto BACKPRESSURE_DELAY = 100ms;
-    static constexpr unsigned SEND_SUCCESS = 0xFFFFFFFF;
-    enum class SType {Bin, Txt};
+    using Queue = SendQueue<WSSocket>;
 
     bool has_backpressure(WSSocket* s, size_t len) {
         const auto webSocketContextData = static_cast<uWS::WebSocketContextData<false, ExtraSocketData>*>
         (us_socket_context_ext(false, us_socket_context(false, reinterpret_cast<us_socket_t *> (s))));
-        const auto free_space =  webSocketContextData->maxBackpressure - s->getBufferedAmount(); 
-        if(len > webSocketContextData->maxBackpressure) {
-            GempyreUtils::log(GempyreUtils::LogLevel::Fatal,
-            "Too much data: max:", webSocketContextData->maxBackpressure,
-            "Data size:", len,
-            "Free:", free_space);
-        }
+        const auto buffered = s->getBufferedAmount();
+        const auto free_space = webSocketContextData->maxBackpressure > buffered ? webSocketContextData->maxBackpressure - buffered : 0;
         if(len > free_space) {
             GempyreUtils::log(GempyreUtils::LogLevel::Debug, "buf full", free_space, len);
             return true;
@@ -46,40 +50,109 @@ class Broadcaster {
     Broadcaster(const Gempyre::Broadcaster&) = delete;
     Broadcaster& operator=(const Gempyre::Broadcaster&) = delete;
 public:
-    
-    Broadcaster(const std::function<void(WSSocket*, WSSocket::SendStatus)>& resendRequest) : m_resendRequest{resendRequest} {}
+    static constexpr size_t FRAGMENT_SIZE = 1024 * 1024;        // larger messages are sent in fragments, see write_part
 
-    bool send(Server::TargetSocket send_to, std::string&& text) {
-        GempyreUtils::log(GempyreUtils::LogLevel::Debug, "send txt", text.size());
+    Broadcaster(const std::function<void(WSSocket*, WSSocket::SendStatus)>& resendRequest, const Server::Compression& compression) :
+        m_resendRequest{resendRequest}, m_compression{compression} {
+#ifdef UWS_NO_ZLIB
+        if(m_compression.mode != Server::Compression::Mode::Off)
+            GempyreUtils::log(GempyreUtils::LogLevel::Warning, "Compression is not available, built without zlib");
+#endif
+    }
+
+    // value is encoded for each socket either as JSON text or MessagePack, see set_packed
+    bool send(Server::TargetSocket send_to, const Server::Value& value, Server::Lane lane) {
         const std::lock_guard<std::mutex> lock(m_socketMutex);
-        const auto sz = text.size();
-        if(send_to == Server::TargetSocket::All) {
-            for(auto& [s, type] : m_sockets) {
-                auto copy_of_text = text;
-                add_queue(s, std::move(copy_of_text));
-                socket_send(s, sz);
+        std::string text;
+        std::string packed;
+        for(auto& [s, type] : m_sockets) {
+            if(send_to != Server::TargetSocket::All && type != send_to)
+                continue;
+            const auto is_packed = m_packed.count(s) > 0;
+            auto& encoded = is_packed ? packed : text;
+            if(encoded.empty()) {
+                if(is_packed)
+                    json::to_msgpack(value, encoded);
+                else
+                    encoded = value.dump();
             }
-        } else {
-            for(auto& [s, type] : m_sockets) {
-                if(type != send_to)
-                    continue;
-                auto copy_of_text = text;
-                add_queue(s, std::move(copy_of_text));
-                socket_send(s, sz);
+            GempyreUtils::log(GempyreUtils::LogLevel::Debug, "send", is_packed ? "msgpack" : "txt", encoded.size());
+            sample(encoded, true);
+            auto copy_of_message = encoded;
+            const auto sz = copy_of_message.size();
+            m_queue.push(s, std::move(copy_of_message), is_packed, lane);
+            socket_send(s, sz);
+        }
+        GempyreUtils::log(GempyreUtils::LogLevel::Debug, "sent", !m_sockets.empty());
+        return !m_sockets.empty();
+    }
+
+    // batch is already encoded, the last socket of each encoding gets the buffer without a copy. A socket that
+    // connected or changed its encoding after the batch began gets the text, UI reads it on any socket, and text is
+    // decoded from MessagePack if the batch has only that.
+    bool send(Server::TargetSocket send_to, Batch::Message&& message, Server::Lane lane) {
+        const std::lock_guard<std::mutex> lock(m_socketMutex);
+        std::vector<std::pair<WSSocket*, bool>> targets;
+        for(auto& [s, type] : m_sockets) {
+            if(send_to != Server::TargetSocket::All && type != send_to)
+                continue;
+            const auto is_packed = m_packed.count(s) > 0 && !message.packed.empty();
+            if(!is_packed && message.text.empty()) {
+                GempyreUtils::log(GempyreUtils::LogLevel::Debug, "Batch text decoded for socket");
+                message.text = json::from_msgpack(message.packed).dump();
             }
+            targets.emplace_back(s, is_packed);
+        }
+        for(auto it = targets.begin(); it != targets.end(); ++it) {
+            const auto [s, is_packed] = *it;
+            auto& encoded = is_packed ? message.packed : message.text;
+            const auto last = std::none_of(std::next(it), targets.end(), [is_packed = is_packed](const auto& t) {return t.second == is_packed;});
+            auto buffer = last ? std::move(encoded) : encoded;
+            const auto sz = buffer.size();
+            GempyreUtils::log(GempyreUtils::LogLevel::Debug, "send batch", is_packed ? "msgpack" : "txt", sz, message.operations);
+            sample(buffer, true);
+            m_queue.push(s, std::move(buffer), is_packed, lane);
+            socket_send(s, sz);
         }
-        GempyreUtils::log(GempyreUtils::LogLevel::Debug, "sent txt", !m_sockets.empty());
         return !m_sockets.empty();
     }
 
-    bool send(DataPtr&& ptr, bool droppable) {
+    // encodings used by the sockets
+    Batch::Encodings encodings(Server::TargetSocket target) const {
+        const std::lock_guard<std::mutex> lock(m_socketMutex);
+        Batch::Encodings encodings{false, false};
+        for(const auto& [s, type] : m_sockets) {
+            if(target != Server::TargetSocket::All && type != target)
+                continue;
+            if(m_packed.count(s))
+                encodings.packed = true;
+            else
+                encodings.text = true;
+        }
+        if(!encodings.text && !encodings.packed)
+            encodings.text = true;
+        return encodings;
+    }
+
+    // a sent message buffer for reuse
+    std::string buffer() {
+        std::unique_lock<std::mutex> lock(m_poolMutex);
+        if(m_pool.empty())
+            return {};
+        auto buffer = std::move(m_pool.back());
+        m_pool.pop_back();
+        return buffer;
+    }
+
+    bool send(DataPtr&& ptr, bool droppable, Server::Lane lane) {
         GempyreUtils::log(GempyreUtils::LogLevel::Debug, "send bin", ptr->size());
         const std::lock_guard<std::mutex> lock(m_socketMutex);
         for(auto& [s, type] : m_sockets) {
             if(type == Server::TargetSocket::Ui) { // extension is not expected to handle binary messages
-                const auto sz = ptr->size();
-                add_queue(s, std::move(ptr), droppable);
-                socket_send(s, sz);
+                const auto& [bytes, len] = ptr->payload();
+                sample({bytes, len}, false);
+                m_queue.push(s, ptr, droppable, lane);
+                socket_send(s, ptr->size());
             }
         }
         GempyreUtils::log(GempyreUtils::LogLevel::Debug, "sent bin", !m_sockets.empty());
@@ -97,6 +170,8 @@ public:
         if(it != m_sockets.end()) {
             m_sockets.erase(it);
         }
+        m_packed.erase(socket);
+        m_queue.remove(socket);
         GempyreUtils::log(GempyreUtils::LogLevel::Debug, "socket erased", m_sockets.size());
     }
 
@@ -122,141 +197,227 @@ public:
         return m_sockets.size();
     }
 
+    size_t count(Server::TargetSocket target) const {
+        const std::lock_guard<std::mutex> lock(m_socketMutex);
+        return static_cast<size_t>(std::count_if(m_sockets.begin(), m_sockets.end(), [target](const auto& s) {
+            return target == Server::TargetSocket::All || s.second == target;}));
+    }
+
     void setType(WSSocket* ws, Server::TargetSocket type) {
         const std::lock_guard<std::mutex> lock(m_socketMutex);
         assert(m_sockets[ws] == Server::TargetSocket::Undefined);
         m_sockets[ws] = type;
     }
 
+    // socket messages are sent as MessagePack from now on
+    void set_packed(WSSocket* ws) {
+        const std::lock_guard<std::mutex> lock(m_socketMutex);
+        m_packed.insert(ws);
+        m_queue.push(ws, json{{"type", "encoding"}, {"encoding", "msgpack"}}.dump(), false);
+        socket_send(ws, 0);
+    }
+
+    void received(size_t bytes) {
+        ++m_receivedMessages;
+        m_receivedBytes += bytes;
+    }
+
     void drain(WSSocket* ws) {
         send_all(ws);
     }
 
+    Server::Pressure pressure() const {
+        Server::Pressure p;
+        p.buffered = m_buffered;
+        p.written = m_written;
+        p.queued = m_queue.queued();
+        return p;
+    }
+
+    Server::Traffic traffic() const {
+        Server::Traffic t;
+        t.messages_sent = m_sentMessages;
+        t.bytes_sent = m_written;
+        t.messages_received = m_receivedMessages;
+        t.bytes_received = m_receivedBytes;
+        t.compressed_messages = m_compressedMessages;
+        t.compressed_bytes = m_compressedBytes;
+        if(m_sampledIn > 0) {
+            // uws does not tell the size nor time of its compression, they are estimated from the samples
+            t.compression_ratio = static_cast<double>(m_sampledOut) / static_cast<double>(m_sampledIn);
+            t.compression_time_us = static_cast<size_t>(static_cast<double>(m_sampledTime) *
+                static_cast<double>(m_compressedBytes) / static_cast<double>(m_sampledIn));
+        }
+        t.interactive = laneDelay(Server::Lane::Interactive);
+        t.bulk = laneDelay(Server::Lane::Bulk);
+        const std::lock_guard<std::mutex> lock(m_socketMutex);
+        for(const auto& [s, type] : m_sockets)
+            if(type == Server::TargetSocket::Ui && m_packed.count(s))
+                t.packed = true;
+        return t;
+    }
+
+    // a message of this size is sent compressed, fragmented ones are not, see write_part
+    bool compressed(size_t len, bool control) const {
+#ifdef UWS_NO_ZLIB
+        (void) len;
+        (void) control;
+        return false;
+#else
+        switch(m_compression.mode) {
+        case Server::Compression::Mode::Off: return false;
+        case Server::Compression::Mode::Text: return control && len >= m_compression.min_size;
+        case Server::Compression::Mode::All: return len >= m_compression.min_size;
+        }
+        return false;
+#endif
+    }
+
+    // payload fetched over HTTP is compressed here as the websocket would do, nullopt if it is not compressed
+    std::optional<std::string> deflate(std::string_view data, bool control) {
+#ifdef UWS_NO_ZLIB
+        (void) data;
+        (void) control;
+        return std::nullopt;
+#else
+        if(!compressed(data.size(), control))
+            return std::nullopt;
+        std::string out;
+        const auto time = compress(data, out);
+        if(!time)
+            return std::nullopt;
+        ++m_compressedMessages;
+        m_compressedBytes += data.size();
+        m_sampledIn += data.size();
+        m_sampledOut += out.size();
+        m_sampledTime += *time;
+        return out;
+#endif
+    }
+
     void set_loop( uWS::Loop* loop) {
         m_loop = loop;
     }
 
 // check if there is data in queues and request their send
     void flush() {
-        bool has_data = false;
-        if(!has_data) {
-        std::unique_lock<std::mutex> lock(m_sendTxtMutex);
-            has_data |=  !m_textQueue.empty();   
-        }
-        if(!has_data) {
-        std::unique_lock<std::mutex> lock(m_sendTxtMutex);
-            has_data |=  !m_textQueue.empty();   
-        }
-        if(has_data) {
+        if(!m_queue.empty()) {
             socket_send(nullptr, 0);
         }
     }
 
 private:
-    // see socket_send
-    void add_queue(WSSocket* s, std::string&& text) {
-        std::unique_lock<std::mutex> lock(m_sendTxtMutex);
-        m_textQueue.push_back(std::make_tuple(s, std::move(text)));
-    }
-
-    // see socket_send
-    void add_queue(WSSocket* s, DataPtr&& ptr, bool droppable) {
-        std::unique_lock<std::mutex> lock(m_sendBinMutex);
-        m_dataQueue.push_back(std::make_tuple(s, std::move(ptr), droppable));
+    Server::LaneDelay laneDelay(Server::Lane lane) const {
+        const auto delay = m_queue.delay(lane);
+        return {delay.messages, static_cast<size_t>(delay.total.count()), static_cast<size_t>(delay.max.count())};
     }
 
-    bool forceReduceData() {
-        std::unique_lock<std::mutex> lock(m_sendBinMutex);
-        return forceReduceData_unsafe();
+    // Writes the next part of the message, see SendQueue::send
+    Queue::Status write_next(WSSocket* s, Queue::Message& message) {
+        const auto data = message.payload();
+        if(has_backpressure(s, std::min(FRAGMENT_SIZE, data.size() - message.offset)))
+            return Queue::Status::Blocked;
+        const auto start = message.offset;
+        const auto opcode = message.kind == Queue::Kind::Text ? uWS::OpCode::TEXT : uWS::OpCode::BINARY;
+        const auto status = write_part(s, data, message.offset, opcode, message.kind != Queue::Kind::Data);
+        if(status == WSSocket::SendStatus::DROPPED)
+            return Queue::Status::Dropped;
+        m_written += message.offset - start;
+        return status == WSSocket::SendStatus::BACKPRESSURE ? Queue::Status::Backpressure : Queue::Status::Sent;
     }
 
-     bool forceReduceData_unsafe() {
-        const auto sz = m_dataQueue.size();
-        for(auto it = m_dataQueue.begin(); it != m_dataQueue.end();) {
-            auto& [s, ptr, droppable] = *it;
-            if(droppable) {
-                m_dataQueue.erase(it);
-            } else {
-                ++it;
-            }   
+    // A message larger than FRAGMENT_SIZE is sent as websocket fragments, one call sends one fragment and
+    // advances offset. Fragments are flow controlled as any message, SendQueue does not start the next
+    // message before the last fragment is sent.
+    WSSocket::SendStatus write_part(WSSocket* s, std::string_view data, size_t& offset, uWS::OpCode opcode, bool control) {
+        if(offset == 0 && data.size() <= FRAGMENT_SIZE) {
+            const auto status = write(s, data, opcode, control);
+            if(status != WSSocket::SendStatus::DROPPED)
+                offset = data.size();
+            return status;
         }
-        return sz != m_dataQueue.size();
+        const auto len = std::min(FRAGMENT_SIZE, data.size() - offset);
+        const auto part = data.substr(offset, len);
+        // uws compresses each frame on its own, and that does not work with fragments
+        const auto status = offset == 0 ? s->sendFirstFragment(part, opcode) :
+            (offset + len == data.size() ? s->sendLastFragment(part) : s->sendFragment(part));
+        if(status != WSSocket::SendStatus::DROPPED)
+            offset += len;
+        return status;
     }
 
-    void removeDuplicates_unsafe() {
-        m_textQueue.erase(std::unique(m_textQueue.begin(), m_textQueue.end()), m_textQueue.end());
-
-    }
-
-    void removeDuplicates() {
-        std::unique_lock<std::mutex> lock(m_sendBinMutex);   
-        removeDuplicates_unsafe();
+    WSSocket::SendStatus write(WSSocket* s, std::string_view data, uWS::OpCode opcode, bool control) {
+        if(!compressed(data.size(), control))
+            return s->send(data, opcode);
+        ++m_compressedMessages;
+        m_compressedBytes += data.size();
+        return s->send(data, opcode, true);
     }
 
-    void send_text(WSSocket* target_socket) {
-        std::unique_lock<std::mutex> lock(m_sendTxtMutex);
-        for(auto it = m_textQueue.begin(); it != m_textQueue.end();) {
-            auto& [s, txt] = *it;
-            if(target_socket && target_socket != s)
-                continue;
-            if(has_backpressure(s, txt.size())) {
-                // remove all extra and wait for drain
-                if(!forceReduceData())
-                    removeDuplicates_unsafe();
-                return;
-            }
-            const WSSocket::SendStatus status = s->send(txt, uWS::OpCode::TEXT);
-            if(status == WSSocket::SendStatus::SUCCESS) {
-                m_textQueue.erase(it);
-            } else {
-                if(status == WSSocket::SendStatus::BACKPRESSURE) {
-                    // This should not happen, but who knows uws
-                     if(!forceReduceData())
-                        removeDuplicates_unsafe();
-                }
-                if(status != WSSocket::SendStatus::BACKPRESSURE)
-                    m_resendRequest(s, status);
-                return;
-            }
+    // Every nth message uws will compress is compressed also here to estimate the ratio and time. This runs in the
+    // sending thread, not in the uws thread, and only compression is timed.
+    void sample(std::string_view data, bool control) {
+#ifdef UWS_NO_ZLIB
+        (void) data;
+        (void) control;
+#else
+        if(data.size() > FRAGMENT_SIZE || !compressed(data.size(), control) || m_sampleCount++ % RATIO_SAMPLING != 0)
+            return;
+        if(const auto time = compress(data, m_sample)) {
+            m_sampledIn += data.size();
+            m_sampledOut += m_sample.size();
+            m_sampledTime += *time;
         }
+#endif
     }
 
-    void send_bin(WSSocket* target_socket) {
-        std::unique_lock<std::mutex> lock(m_sendBinMutex);
-        for(auto it = m_dataQueue.begin(); it != m_dataQueue.end();) {
-            auto& [s, ptr, droppable] = *it;
-            if(target_socket && target_socket != s)
-                continue;
-            const auto& [data, len] = ptr->payload();
-            if(has_backpressure(s, len)) {
-                if(droppable)
-                    m_dataQueue.erase(it);
-                return;
-            }
+#ifndef UWS_NO_ZLIB
+    // returns microseconds spent
+    static std::optional<size_t> compress(std::string_view data, std::string& out) {
+        const auto start = std::chrono::steady_clock::now();
+        auto len = compressBound(static_cast<uLong>(data.size()));
+        out.resize(len);
+        if(compress2(reinterpret_cast<Bytef*>(out.data()), &len, reinterpret_cast<const Bytef*>(data.data()),
+            static_cast<uLong>(data.size()), Z_DEFAULT_COMPRESSION) != Z_OK)
+            return std::nullopt;
+        out.resize(len);
+        return static_cast<size_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+#endif
 
-            const WSSocket::SendStatus status = s->send(std::string_view(data, len), uWS::OpCode::BINARY);
-                    
-            if(status == WSSocket::SendStatus::SUCCESS || !droppable) {
-                m_dataQueue.erase(it);
-            } else {
-                if(status != WSSocket::SendStatus::BACKPRESSURE) {
-                    m_resendRequest(s, status); // on drops we keep non-droppables and request resend
-                    return;
-                } else {
-                    ++it; // on backpressure  we keep non-droppables
-                }
-            }
+    void recycle(std::string&& buffer) {
+        std::unique_lock<std::mutex> lock(m_poolMutex);
+        if(m_pool.size() < POOLED_BUFFERS && buffer.capacity() >= POOLED_MIN_SIZE && buffer.capacity() <= POOLED_MAX_SIZE) {
+            buffer.clear();
+            m_pool.push_back(std::move(buffer));
         }
-    }        
+    }
 
     void send_all(WSSocket* target_socket) {
-        send_text(target_socket);
-        send_bin(target_socket);
+        m_queue.send(target_socket,
+            [this](WSSocket* s, Queue::Message& message) {return write_next(s, message);},
+            [this](WSSocket*, Queue::Message&& message) {
+                ++m_sentMessages;
+                if(message.kind != Queue::Kind::Data)
+                    recycle(std::move(message.text));
+            },
+            [this](WSSocket* s) {m_resendRequest(s, WSSocket::SendStatus::DROPPED);}); // message is kept and resend requested
+        update_buffered();
+    }
+
+    // uws socket state can be read only in its thread
+    void update_buffered() {
+        const std::lock_guard<std::mutex> lock(m_socketMutex);
+        size_t buffered = 0;
+        for(const auto& [s, type] : m_sockets)
+            if(type == Server::TargetSocket::Ui)
+                buffered += s->getBufferedAmount();
+        m_buffered = buffered;
     }
 
     // uws requires send happen in its thread, therefore we queue them and then send them using m_loop->defer
     void socket_send(WSSocket* ws, size_t sz) {
-         if(ws && sz > 0 && has_backpressure(ws, sz)) {
+         if(ws && sz > 0 && has_backpressure(ws, std::min(FRAGMENT_SIZE, sz))) {
             std::this_thread::sleep_for(BACKPRESSURE_DELAY);
          }
          m_loop->defer([this] () { // this happens in server thread 
@@ -267,12 +428,27 @@ private:
 private:
     std::function<void (WSSocket*, WSSocket::SendStatus)> m_resendRequest;
     std::unordered_map<WSSocket*, Server::TargetSocket> m_sockets{};
-    std::mutex m_sendTxtMutex{};
-    std::mutex m_sendBinMutex{};
-    std::vector<std::tuple<WSSocket*, std::string>> m_textQueue{};
-    std::vector<std::tuple<WSSocket*, DataPtr, bool>> m_dataQueue{};
+    std::unordered_set<WSSocket*> m_packed{};
+    Queue m_queue{};
     mutable std::mutex m_socketMutex{};
+    std::mutex m_poolMutex{};
+    std::vector<std::string> m_pool{};
     uWS::Loop* m_loop{nullptr};
+    std::atomic<size_t> m_buffered{0};
+    std::atomic<size_t> m_written{0};
+    std::atomic<size_t> m_sentMessages{0};
+    std::atomic<size_t> m_receivedMessages{0};
+    std::atomic<size_t> m_receivedBytes{0};
+    const Server::Compression m_compression;
+    std::atomic<size_t> m_compressedMessages{0};
+    std::atomic<size_t> m_compressedBytes{0};
+    std::atomic<size_t> m_sampleCount{0};
+    std::atomic<size_t> m_sampledIn{0};
+    std::atomic<size_t> m_sampledOut{0};
+    std::atomic<size_t> m_sampledTime{0};
+#ifndef UWS_NO_ZLIB
+    std::string m_sample{}; // guarded by m_socketMutex
+#endif
     };
 }
 
@@ -1,12 +1,16 @@
 #include "uws_server.h"
 #include "gempyre_utils.h"
 #include "broadcaster.h"
+#include "batch.h"
+#include "canvas_data.h"
 #include <unordered_map>
 #include <unordered_set>
 #include <thread>
 #include <chrono>
 #include <random>
 #include <numeric>
+#include <algorithm>
+#include <cstring>
 #include <nlohmann/json.hpp>
 
 // for convenience
@@ -22,9 +26,22 @@ using namespace Gempyre;
 constexpr unsigned PAYLOAD_SIZE = 8 * 1024 * 1024;
 constexpr unsigned BACKPRESSURE_SIZE = 8 * 1024 * 1024;
 
-#ifdef PULL_MODE
-constexpr size_t WS_MAX_LEN = 16 * 1024;
-#endif
+// batch is split to several messages when it grows larger
+constexpr size_t BATCH_MAX_OPS = 512;
+
+
+// UI sends messages larger than its fragment size as fragments, see sendFragments in gempyre.js
+constexpr std::string_view FRAGMENT_MAGIC{"GFRG"};
+constexpr size_t FRAGMENT_HEADER = 12;
+constexpr uint32_t FRAGMENT_LAST = 0x1;
+constexpr uint32_t FRAGMENT_PACKED = 0x2;
+constexpr size_t INBOUND_MAX_SIZE = 64 * 1024 * 1024;
+
+// larger payloads are fetched by UI over http, see notifyPulled. Below this a fragmented websocket message is as
+// fast and does not need a request round trip.
+constexpr size_t PULL_SIZE = 4 * 1024 * 1024;
+constexpr size_t PULL_STORE_SIZE = 64 * 1024 * 1024;
+constexpr auto PULL_EXPIRY = 60s;
 
 constexpr auto SERVICE_NAME = "Gempyre";
 
@@ -36,13 +53,45 @@ std::unique_ptr<Server> Gempyre::create_server(unsigned int port,
            const Server::GetFunction& onGet,
            const Server::ListenFunction& onListen,
            int queryIdBase,
-           const Server::ResendRequest& request) {
+           const Server::ResendRequest& request,
+           const Server::Compression& compression) {
                 return std::unique_ptr<Server>(new Uws_Server(
-                    port, rootFolder, onOpen, onMessage, onClose, onGet, onListen, queryIdBase, request
+                    port, rootFolder, onOpen, onMessage, onClose, onGet, onListen, queryIdBase, request, compression
                     ));
            }
 
 
+static uWS::CompressOptions compressOptions(const Server::Compression& compression) {
+    if(compression.mode == Server::Compression::Mode::Off)
+        return uWS::DISABLED;
+    constexpr uWS::CompressOptions dedicated[] = {
+        uWS::DEDICATED_COMPRESSOR_3KB, uWS::DEDICATED_COMPRESSOR_4KB, uWS::DEDICATED_COMPRESSOR_8KB,
+        uWS::DEDICATED_COMPRESSOR_16KB, uWS::DEDICATED_COMPRESSOR_32KB, uWS::DEDICATED_COMPRESSOR_64KB,
+        uWS::DEDICATED_COMPRESSOR_128KB, uWS::DEDICATED_COMPRESSOR_256KB};
+    const auto level = std::clamp(compression.level, 0, static_cast<int>(std::size(dedicated)));
+    const auto compressor = level == 0 ? uWS::SHARED_COMPRESSOR : dedicated[level - 1];
+    return static_cast<uWS::CompressOptions>(compressor | uWS::SHARED_DECOMPRESSOR);
+}
+
+// size of string values, a cheap estimate to avoid encoding all messages to see if they are large
+static size_t stringSize(const json& value) {
+    size_t size = 0;
+    for(const auto& item : value)
+        if(item.is_string())
+            size += item.get_ref<const std::string&>().size();
+    return size;
+}
+
+// toHandle replaces the owner id of a bitmap with a handle, the last word of data
+static std::optional<dataT> handleOf(const Gempyre::DataPtr& ptr) {
+    if(ptr->type() != CanvasData::CanvasHandleId)
+        return std::nullopt;
+    const auto& [bytes, len] = ptr->payload();
+    dataT handle;
+    std::memcpy(&handle, bytes + len - sizeof(dataT), sizeof(dataT));
+    return handle;
+}
+
 static std::string toLower(const std::string& str) {
     std::string s = str;
     std::transform(s.begin(), s.end(), s.begin(), [](auto c) {return std::tolower(c);});
@@ -51,26 +100,6 @@ static std::string toLower(const std::string& str) {
 
 
 
-class Gempyre::Batch {
-public:
-    Batch() : m_arrays{} {
-    }
-
-    void push_back(Server::TargetSocket target, json&& jobj) {
-        m_arrays[target].push_back(std::forward<json>(jobj));
-    }
-
-    std::string dump(Server::TargetSocket target) {
-        auto data = json::object();
-        data["type"] = "batch";
-        data["batches"] =  std::move(m_arrays[target]);
-        return data.dump();
-    }
-private:
-    std::unordered_map<Server::TargetSocket, json::array_t> m_arrays;
-};
-
-
 class Gempyre::SocketHandler {
     public:
     explicit SocketHandler(Uws_Server& server) : m_s(server){}
@@ -82,7 +111,34 @@ class Gempyre::SocketHandler {
     }
     
 
+    // returns true when message is complete, fragments are collected until the last one is received
+    bool fragmentHandler(WSSocket* ws, std::string_view message, std::string& assembled, bool& packed) {
+        const auto word = [&message](size_t pos) {
+            uint32_t value = 0;
+            for(auto i = 0U; i < 4; ++i)
+                value |= static_cast<uint32_t>(static_cast<uint8_t>(message[pos + i])) << (8 * i);
+            return value;
+        };
+        const auto seq = word(4);
+        const auto flags = word(8);
+        auto& [next, buffer] = m_s.m_inbound[ws];
+        if(seq != next || buffer.size() + message.size() - FRAGMENT_HEADER > INBOUND_MAX_SIZE) {
+            GempyreUtils::log(GempyreUtils::LogLevel::Error, "WS", "fragmented message dropped", seq, next, buffer.size());
+            m_s.m_inbound.erase(ws);
+            return false;
+        }
+        buffer.append(message.substr(FRAGMENT_HEADER));
+        ++next;
+        if(!(flags & FRAGMENT_LAST))
+            return false;
+        packed = flags & FRAGMENT_PACKED;
+        assembled = std::move(buffer);
+        m_s.m_inbound.erase(ws);
+        return true;
+    }
+
     void closeHandler(WSSocket* ws, int code, std::string_view message) {
+        m_s.m_inbound.erase(ws);
         if(code != 1001 && code != 1006) {  //browser window closed
             if(code == 1000 || (code != 1005 && code >= 1002 && code <= 1015)  || (code >= 3000 && code <= 3999) || (code >= 4000 && code <= 4999)) {
                 GempyreUtils::log(GempyreUtils::LogLevel::Error, "WS", "closed on error", code, message);
@@ -115,13 +171,15 @@ Uws_Server::Uws_Server(
     const Server::GetFunction& onGet,
     const Server::ListenFunction& onListen,
     int queryIdBase,
-    const Server::ResendRequest& resendRequest) : Server{port, root, onOpen, onMessage, onClose, onGet, onListen, queryIdBase},
+    const Server::ResendRequest& resendRequest,
+    const Server::Compression& compression) : Server{port, root, onOpen, onMessage, onClose, onGet, onListen, queryIdBase},
     //mStartFunction([this]()->std::unique_ptr<std::thread> {
 //   return makeServer();
 //}),
     m_broadcaster(std::make_unique<Broadcaster>([resendRequest](WSSocket*, WSSocket::SendStatus) {
         resendRequest();
-    })),
+    }, compression)),
+    m_compression{compression},
     m_serverThread{newThread()} {
 #ifdef RANDOM_PORT
     const auto seed = std::chrono::system_clock::now().time_since_epoch().count();
@@ -135,6 +193,18 @@ Uws_Server::Uws_Server(
     m_broadcaster->flush();
  }
 
+Server::Pressure Uws_Server::pressure() const {
+    return m_broadcaster->pressure();
+}
+
+Server::Traffic Uws_Server::traffic() const {
+    auto traffic = m_broadcaster->traffic();
+    traffic.coalesced = m_coalesced;
+    traffic.pulled_messages = m_pulledMessages;
+    traffic.pulled_bytes = m_pulledBytes;
+    return traffic;
+}
+
 std::unique_ptr<std::thread> Uws_Server::newThread() {
     auto thread = std::make_unique<std::thread>([this]() {
                 serverThread(m_port);
@@ -162,8 +232,15 @@ void Uws_Server::serverThread(unsigned int port) {
         Gempyre::SocketHandler(*this).openHandler(ws);
     };;
     behavior.message =  [this](auto ws, auto message, auto opCode) {
-        (void) opCode;
-        switch(messageHandler(message)) {
+        m_broadcaster->received(message.size());
+        auto packed = opCode == uWS::OpCode::BINARY;
+        std::string assembled;
+        if(packed && message.size() >= FRAGMENT_HEADER && message.substr(0, FRAGMENT_MAGIC.size()) == FRAGMENT_MAGIC) {
+            if(!Gempyre::SocketHandler(*this).fragmentHandler(ws, message, assembled, packed))
+                return;
+            message = assembled;
+        }
+        switch(messageHandler(message, packed)) {
             case MessageReply::DoNothing:
                 if(m_doExit) {
                     ws->close();
@@ -171,8 +248,15 @@ void Uws_Server::serverThread(unsigned int port) {
                 return;
             case MessageReply::AddUiSocket:
                 m_uiready = true;
+                m_resetHandles = true; // new UI has no handles
                 m_broadcaster->setType(ws, Server::TargetSocket::Ui);
                 return;
+            case MessageReply::AddPackedUiSocket:
+                m_uiready = true;
+                m_resetHandles = true; // new UI has no handles
+                m_broadcaster->setType(ws, Server::TargetSocket::Ui);
+                m_broadcaster->set_packed(ws);
+                return;
              case MessageReply::AddExtensionSocket:
                  m_broadcaster->setType(ws, Server::TargetSocket::Extension);
                 return;
@@ -185,6 +269,7 @@ void Uws_Server::serverThread(unsigned int port) {
         Gempyre::SocketHandler(*this).closeHandler(ws, code, message);
     };
     behavior.maxPayloadLength =  PAYLOAD_SIZE;
+    behavior.compression = compressOptions(m_compression);
     behavior.maxBackpressure = BACKPRESSURE_SIZE;
     behavior.drain = [this](auto ws) {
         GempyreUtils::log(GempyreUtils::LogLevel::Debug, "drain", ws->getBufferedAmount());
@@ -199,19 +284,35 @@ void Uws_Server::serverThread(unsigned int port) {
     .ws<ExtraSocketData>("/" + toLower(SERVICE_NAME), std::move(behavior))
     .get("/data/:id", [this](auto * res, auto * req) {
         const auto id = std::string(req->getParameter(0)); //till c++20 ?
+        std::unique_lock<std::mutex> lock(m_pullMutex);
         const auto it = m_pulled.find(id);
         if(it == m_pulled.end()) {
+            lock.unlock();
             res->writeStatus("404 Not Found");
             res->writeHeader("Content-Type", "text/html; charset=utf-8");
             res->end(notFoundPage(req->getUrl()));
             GempyreUtils::log(GempyreUtils::LogLevel::Error, "pull not found", id);
 
         } else {
-            const auto mime = std::get<DataType>(it->second) == DataType::Json ? "application/json" : "application/octet-stream";
-            res->writeHeader("Content-Type", mime);
+            // every UI window fetches the payload, it is kept until the last one has, or it expires
+            const Pulled pulled = it->second; // payload is shared, not copied
+            if(--it->second.readers == 0) {
+                m_pulledSize -= pulled.size;
+                m_pulled.erase(it);
+            }
+            lock.unlock();
+            const auto mime = pulled.type == DataType::Json ? "application/json" :
+                (pulled.type == DataType::Packed ? "application/msgpack" : "application/octet-stream");
             res->writeStatus(uWS::HTTP_200_OK);
-            res->end(std::get<std::string>(it->second));
-            m_pulled.erase(it);
+            res->writeHeader("Content-Type", mime);
+            res->writeHeader("Cache-Control", "no-store");
+            if(pulled.deflated)
+                res->writeHeader("Content-Encoding", "deflate");
+            if(pulled.ptr) {
+                const auto& [data, len] = pulled.ptr->payload();
+                res->end(std::string_view(data, len));
+            } else
+                res->end(*pulled.data);
         }
     })
     .get("/*", [this](auto * res, auto * req) {
@@ -308,9 +409,34 @@ Uws_Server::~Uws_Server() {
     assert(!m_broadcaster ||  m_broadcaster->empty());
 }
 
-int Uws_Server::addPulled(DataType type, const std::string_view& data) {
+// returns nullopt if store has no space, then data is not moved and it is sent on the websocket
+// Payload is compressed as websocket would, a pulled message is too large for uws to compress, see Broadcaster::write_part.
+std::optional<int> Uws_Server::addPulled(DataType type, std::string&& data, const Gempyre::DataPtr& ptr) {
+    const auto payload = ptr ? std::string_view(std::get<0>(ptr->payload()), std::get<1>(ptr->payload())) : std::string_view(data);
+    auto deflated = m_broadcaster->deflate(payload, type != DataType::Bin);
+    const auto size = deflated ? deflated->size() : payload.size();
+    const auto now = std::chrono::steady_clock::now();
+    const std::lock_guard<std::mutex> lock(m_pullMutex);
+    for(auto it = m_pulled.begin(); it != m_pulled.end();) {
+        if(it->second.expires < now) {
+            GempyreUtils::log(GempyreUtils::LogLevel::Warning, "pull expired", it->first);
+            m_pulledSize -= it->second.size;
+            it = m_pulled.erase(it);
+        } else
+            ++it;
+    }
+    if(m_pulledSize + size > PULL_STORE_SIZE) {
+        GempyreUtils::log(GempyreUtils::LogLevel::Debug, "pull store full", m_pulledSize, size);
+        return std::nullopt;
+    }
     ++m_pulledId;
-    m_pulled.emplace(std::to_string(m_pulledId), std::pair<DataType, std::string> {type, std::string(data)});
+    m_pulledSize += size;
+    auto stored = deflated ? std::make_shared<const std::string>(std::move(*deflated)) :
+        (ptr ? nullptr : std::make_shared<const std::string>(std::move(data)));
+    m_pulled.emplace(std::to_string(m_pulledId), Pulled{type, std::move(stored), deflated ? nullptr : ptr, deflated.has_value(), size,
+        std::max<size_t>(1, m_broadcaster->count(Server::TargetSocket::Ui)), now + PULL_EXPIRY});
+    ++m_pulledMessages;
+    m_pulledBytes += size;
     return m_pulledId;
 }
 
@@ -366,74 +492,174 @@ bool Uws_Server::isUiReady() const {
 }
 
 bool Uws_Server::beginBatch() {
-    m_batch = std::make_unique<Batch>();
+    const std::lock_guard<std::mutex> lock(m_batchMutex);
+    if(!m_batch)
+        m_batch = std::make_unique<Batch>(m_broadcaster->encodings(Server::TargetSocket::Ui),
+            [this](json& value) {toHandle(value);},
+            [this]() {return m_broadcaster->buffer();});
+    ++m_batchDepth; // batches nest, e.g. Ui::begin_batch within an automatic batch
     return true;
 }
 
 bool Uws_Server::endBatch() {
-    if(m_batch) {
-        const auto targets = {Server::TargetSocket::Ui, Server::TargetSocket::Extension};
-        for(const auto target : targets) {
-            auto str = m_batch->dump(target);
-#ifdef PULL_MODE        
-        if(str.size() < WS_MAX_LEN) {
-#endif            
-            if(!m_broadcaster->send(Server::TargetSocket::Ui, std::move(str)))
-                return false;
-#ifdef PULL_MODE                
-        } else {
-            const auto pull = addPulled(DataType::Json, str);
-            const json obj = {{"type", "pull_json"}, {"id", pull}};
-            GempyreUtils::log(GempyreUtils::LogLevel::Debug, "add batch pull", str.size(), pull);
-            if(!m_broadcaster->send(target, obj.dump()))
-                return false;
+    const std::lock_guard<std::mutex> lock(m_batchMutex);
+    if(!m_batch)
+        return true;
+    if(--m_batchDepth > 0)
+        return true;
+    const auto ok = sendBatch();
+    m_batch.reset();
+    m_batchDepth = 0;
+    return ok;
+}
+
+// A message that websocket would compress is pulled already when it is too large for uws to compress, as it is
+// compressed for http, see addPulled.
+size_t Uws_Server::pullSize(bool control) const {
+    return m_broadcaster->compressed(Broadcaster::FRAGMENT_SIZE + 1, control) ? Broadcaster::FRAGMENT_SIZE + 1 : PULL_SIZE;
+}
+
+bool Uws_Server::sendBatch() {
+    if(!syncHandles())
+        return false;
+    auto message = m_batch->take();
+    const auto batchLane = std::exchange(m_batchLane, Server::Lane::Bulk);
+    if(message.operations == 0)
+        return true;
+    // a large batch is pulled if all UI sockets read the same encoding
+    if(message.text.empty() != message.packed.empty()) {
+        const auto packed = message.text.empty();
+        auto& encoded = packed ? message.packed : message.text;
+        if(encoded.size() >= pullSize(true)) {
+            if(const auto id = addPulled(packed ? DataType::Packed : DataType::Json, std::move(encoded), nullptr))
+                return notifyPulled(DataType::Json, *id, batchLane, std::nullopt);
         }
-#endif      
-        }  
-        m_batch.reset();
     }
-    return true;
+    return m_broadcaster->send(Server::TargetSocket::Ui, std::move(message), batchLane);
 }
 
 bool Uws_Server::send(Server::TargetSocket target, Server::Value&& value) {
-    if(m_batch) {
-        m_batch->push_back(target, std::move(value));
+    const std::lock_guard<std::mutex> lock(m_batchMutex);
+    const auto valueLane = lane(value.value("type", std::string{}));
+    if(m_batch && target == Server::TargetSocket::Ui) {
+        // batch is interactive if any of its operations is
+        if(valueLane == Server::Lane::Interactive)
+            m_batchLane = valueLane;
+        m_coalesced += m_batch->push_back(std::move(value));
+        if(m_batch->size() >= BATCH_MAX_OPS)
+            return sendBatch();
     } else {
-            auto str = value.dump();
-#ifdef PULL_MODE        
-        if(str.size() < WS_MAX_LEN) {
-#endif            
-            if(!m_broadcaster->send(target, std::move(str)))
-                return false;
-#ifdef PULL_MODE               
-    This is not working - but keep here as a reference if pull mode want to be re-enabled 
-        } else {
-            const auto pull = addPulled(DataType::Json, str);
-            const json obj = {{"type", "pull_json"}, {"id", pull}};
-            GempyreUtils::log(GempyreUtils::LogLevel::Debug, "add text pull", str.size(), pull);
-            if(!m_broadcaster->send(obj.dump(), is_ext))
-                   return false;
+        if(target == Server::TargetSocket::Ui) {
+            toHandle(value);
+            // a pulled message is always JSON, UI reads it regardless of its socket encoding
+            if(stringSize(value) >= pullSize(true)) {
+                if(const auto id = addPulled(DataType::Json, value.dump(), nullptr))
+                    return notifyPulled(DataType::Json, *id, valueLane, std::nullopt); // e.g. html may create elements
+            }
         }
-#endif
+        if(!m_broadcaster->send(target, value, valueLane))
+            return false;
     }
     return true;
 }
 
 bool Uws_Server::send(Gempyre::DataPtr&& ptr, bool droppable) {
-#ifdef PULL_MODE    
-    if(len < WS_MAX_LEN) {
-#endif        
-        if(!m_broadcaster->send(std::move(ptr), droppable))
-            return false;
-#ifdef PULL_MODE            
+    const std::lock_guard<std::mutex> lock(m_batchMutex);
+    // batched operations were requested before, keep them in order
+    if(m_batch && !sendBatch())
+        return false;
+    if(!toHandle(ptr))
+        return false;
+    // a droppable frame stays on the websocket, where it can be skipped under load
+    if(!droppable && ptr->size() >= pullSize(false)) {
+        if(const auto id = addPulled(DataType::Bin, {}, ptr))
+            return notifyPulled(DataType::Bin, *id, binaryLane(droppable), handleOf(ptr));
+    }
+    if(!m_broadcaster->send(std::move(ptr), droppable, binaryLane(droppable)))
+        return false;
+    return true;
+}
+
+// Payload is parked and UI is notified to fetch it from /data/:id. The notification is sent on the websocket. A bitmap
+// has its canvas handle as a target and UI holds only the later messages of that canvas until the bitmap is drawn.
+// Other payloads can change the document, e.g. create elements later messages refer to, so all later messages wait.
+bool Uws_Server::notifyPulled(DataType type, int id, Server::Lane lane, std::optional<dataT> target) {
+    json notify = {{"type", type == DataType::Bin ? "pull_binary" : "pull_json"}, {"id", id}};
+    if(target)
+        notify["target"] = *target;
+    GempyreUtils::log(GempyreUtils::LogLevel::Debug, "add pull", id);
+    return m_broadcaster->send(Server::TargetSocket::Ui, notify, lane);
+}
+
+// A new UI has no handles, they are assigned anew. If the open batch already refers to them, UIs are told the
+// existing ones before the batch instead.
+bool Uws_Server::syncHandles() {
+    if(!m_resetHandles.exchange(false))
+        return true;
+    if(!m_batch || m_batch->size() == 0) {
+        m_handles.clear();
+        m_nextHandle = 1;
+        return true;
+    }
+    json handles = json::array();
+    for(const auto& [id, handle] : m_handles)
+        handles.push_back(json::array({id, handle}));
+    return m_broadcaster->send(Server::TargetSocket::Ui, json{{"type", "handles"}, {"handles", std::move(handles)}},
+        Server::Lane::Interactive);
+}
+
+// operations that address an element, in others "element" may be e.g. a class name of a query
+static bool isElementOperation(const json& value) {
+    static const std::unordered_set<std::string> operations{
+        "html", "set_attribute", "remove_attribute", "set_style", "remove_style", "remove", "create", "event",
+        "bind", "mirror", "event_notify", Server::POINTER_STREAM, "canvas_draw", "canvas_scale", "canvas_layers",
+        "paint_image", "tile_draw", "nil"};
+    const auto type = value.find("type");
+    return type != value.end() && type->is_string() && operations.count(type->get_ref<const std::string&>()) > 0;
+}
+
+// The first message of an element carries both its id and a new handle, later ones only the handle
+void Uws_Server::toHandle(Server::Value& value) {
+    syncHandles();
+    if(!isElementOperation(value))
+        return;
+    const auto element = value.find("element");
+    if(element == value.end() || !element->is_string())
+        return;
+    const auto id = element->get<std::string>();
+    if(id.empty())
+        return;
+    const auto it = m_handles.find(id);
+    if(it == m_handles.end()) {
+        const auto handle = m_nextHandle++;
+        m_handles.emplace(id, handle);
+        value["handle"] = handle;
     } else {
-        const auto pull = addPulled(DataType::Bin, {data, len});
-        const json obj = {{"type", "pull_binary"}, {"id", pull}};
-        GempyreUtils::log(GempyreUtils::LogLevel::Debug, "add bin pull", len, pull);
-        if(!m_broadcaster->send(obj.dump()))
+        *element = it->second;
+    }
+    const auto type = value.find("type");
+    if(type != value.end() && *type == "remove")
+        m_handles.erase(id);
+}
+
+bool Uws_Server::toHandle(Gempyre::DataPtr& ptr) {
+    if(!ptr->has_owner() || ptr->type() == CanvasData::CanvasHandleId)
+        return true;
+    const auto header = ptr->header();
+    if(!header.empty() && (header.back() & CanvasData::CachedTileFlag))
+        return true;
+    if(!syncHandles())
+        return false;
+    const auto id = ptr->owner();
+    if(m_handles.find(id) == m_handles.end()) {
+        // UI has not seen this element yet, assign the handle with a text message that is sent before binaries,
+        // interactive lane is never behind the bitmap
+        json reg{{"type", "nil"}, {"element", id}};
+        toHandle(reg);
+        if(!m_broadcaster->send(Server::TargetSocket::Ui, reg, Server::Lane::Interactive))
             return false;
     }
-#endif    
+    ptr->setHandle(CanvasData::CanvasHandleId, m_handles[id]);
     return true;
 }
 
@@ -3,6 +3,9 @@
 
 #include "server.h"
 #include "semaphore.h"
+#include "gempyre_types.h"
+#include <mutex>
+#include <chrono>
 
 
 struct us_listen_socket_t;
@@ -25,7 +28,8 @@ public:
            const Server::GetFunction& onGet,
            const Server::ListenFunction& onListen,
            int queryIdBase,
-           const Server::ResendRequest& request);
+           const Server::ResendRequest& request,
+           const Server::Compression& compression);
      
      ~Uws_Server();
 private: // let's not use Server API
@@ -42,12 +46,29 @@ private: // let's not use Server API
     bool beginBatch() override;
     bool endBatch() override;
     void flush() override;
+    Pressure pressure() const override;
+    Traffic traffic() const override;
 private:
     std::unique_ptr<std::thread> makeServer(unsigned short port);
     void doClose();
+    bool sendBatch();
+    size_t pullSize(bool control) const;
+    bool syncHandles();
+    void toHandle(Server::Value& value);
+    bool toHandle(Gempyre::DataPtr& ptr);
     void closeListenSocket();
-    enum class DataType{Json, Bin};
-    int addPulled(DataType, const std::string_view& data);
+    enum class DataType{Json, Packed, Bin};
+    struct Pulled {
+        DataType type;
+        std::shared_ptr<const std::string> data;    // shared with the windows fetching it, as ptr is
+        Gempyre::DataPtr ptr;
+        bool deflated;      // data is compressed, also a bitmap, then ptr is not kept
+        size_t size;
+        size_t readers;     // UI sockets that have not fetched it yet
+        std::chrono::steady_clock::time_point expires;
+    };
+    std::optional<int> addPulled(DataType type, std::string&& data, const Gempyre::DataPtr& ptr);
+    bool notifyPulled(DataType type, int id, Server::Lane lane, std::optional<dataT> target);
     void serverThread(unsigned port);
     bool checkPort();
     std::unique_ptr<std::thread> newThread();
@@ -59,9 +80,23 @@ private:
     ListenSocket m_closeData = nullptr; //arbitrary
     std::atomic_bool m_uiready = false;
 
+    // the batch and handles are used by whichever thread shoots the requests, see Ui::flush
+    std::mutex m_batchMutex{};
     std::unique_ptr<Batch> m_batch{};
-    std::unordered_map<std::string, std::pair<DataType, std::string>> m_pulled{};
+    int m_batchDepth{0};
+    Server::Lane m_batchLane{Server::Lane::Bulk};
+    std::atomic<size_t> m_coalesced{0};
+    std::unordered_map<std::string, dataT> m_handles{}; // element id -> numeric handle known by UI
+    dataT m_nextHandle{1};
+    std::atomic_bool m_resetHandles{false};
+    const Server::Compression m_compression;
+    std::unordered_map<const void*, std::pair<uint32_t, std::string>> m_inbound{}; // socket -> next fragment and received data
+    std::mutex m_pullMutex{};
+    std::unordered_map<std::string, Pulled> m_pulled{};
     int m_pulledId{0};
+    size_t m_pulledSize{0};
+    std::atomic<size_t> m_pulledMessages{0};
+    std::atomic<size_t> m_pulledBytes{0};
     std::atomic_bool m_doExit{false};
     std::atomic_bool m_isRunning{false};
     Semaphore m_waitStart{}; // must be before thread
@@ -1,8 +1,10 @@
 #include "gempyre_test.h"
 #include "gempyre_graphics.h"
+#include "gempyre_pyramid.h"
 #include "gempyre_utils.h"
 #include <cstring> // for std::memcmp
 #include <array>
+#include <filesystem>
 
 using namespace std::chrono_literals;
 using namespace GempyreTest;
@@ -324,6 +326,70 @@ TEST_F(TestUi, draw_bitmap_png) {
     timeout(max_image_wait);
 }
 
+TEST_F(TestUi, render_scale) {
+    MAKE_CANVAS
+    const auto rect = canvas.rect();
+    ASSERT_TRUE(rect);
+    canvas.set_render_scale(0.5, Gempyre::CanvasElement::Smoothing::Nearest, [this, &canvas, rect](int width, int height) {
+        EXPECT_NEAR(width, rect->width / 2, 1);
+        EXPECT_NEAR(height, rect->height / 2, 1);
+        const auto size = canvas.render_size();
+        EXPECT_TRUE(size);
+        EXPECT_EQ(size->first, width);
+        test_exit();
+    });
+    timeout(max_image_wait);
+    ASSERT_TRUE(canvas.render_size());
+}
+
+TEST_F(TestUi, canvas_layers) {
+    Gempyre::CanvasLayers layers(ui(), ui().root(), 200, 100, 3);
+    ASSERT_EQ(layers.count(), 3);
+    layers.layer(0).draw_rect({0, 0, 200, 100}, Gempyre::Color::White);
+    layers.layer(2).draw_rect({10, 10, 4, 4}, Gempyre::Color::Red);
+    EXPECT_EQ(layers.present(), 3U);   // first present sends all
+    EXPECT_EQ(layers.present(), 0U);   // nothing changed
+    layers.layer(2).draw_rect({10, 10, 4, 4}, 0);
+    layers.layer(2).draw_rect({12, 10, 4, 4}, Gempyre::Color::Red);
+    EXPECT_EQ(layers.present(), 1U);   // only moved overlay
+    layers.layer(2).draw_rect({150, 80, 4, 4}, Gempyre::Color::Red);
+    EXPECT_EQ(layers.present(), 1U);
+    layers.layer(2).draw_rect({1, 1, 1, 1}, Gempyre::Color::Red);
+    layers.layer(2).draw_rect({190, 95, 1, 1}, Gempyre::Color::Red);
+    EXPECT_EQ(layers.present(), 2U);   // far apart rows are separate areas
+    layers.invalidate(1);
+    layers.draw_completed([this]() {
+        test_exit();
+    });
+    EXPECT_EQ(layers.present(), 1U);
+    timeout(max_image_wait);
+}
+
+TEST_F(TestUi, pyramid_viewer) {
+    MAKE_CANVAS
+    const auto path = (std::filesystem::temp_directory_path() / "gempyre_apitest.pyr").string();
+    Gempyre::Bitmap image(1000, 600, Gempyre::Color::Blue);
+    image.draw_rect({100, 100, 200, 200}, Gempyre::Color::Yellow);
+    ASSERT_TRUE(Gempyre::Pyramid::build(path, image, 128));
+    auto pyramid = Gempyre::Pyramid::open(path);
+    ASSERT_TRUE(pyramid);
+    EXPECT_EQ(pyramid->levels(), 4);
+    Gempyre::PyramidViewer viewer(canvas, pyramid, 320, 200, 16);
+    EXPECT_EQ(viewer.level(), 1);  // fit zoom is 0.32
+    EXPECT_GT(viewer.cached(), 0U);
+    viewer.zoom(4, 160, 100);
+    EXPECT_EQ(viewer.level(), 0);
+    EXPECT_NEAR(viewer.x(), 500., 0.001);
+    viewer.pan(-50, 0);
+    EXPECT_LE(viewer.cached(), 16U);
+    ui().after(1s, [this]() {
+        test_exit();
+    });
+    timeout(min_image_wait);
+    pyramid.reset();
+    std::filesystem::remove(path);
+}
+
 namespace Gempyre {
 static
 bool operator==(const Gempyre::Bitmap& b1, const Gempyre::Bitmap& b2) {
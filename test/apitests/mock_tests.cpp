@@ -182,6 +182,93 @@ TEST(TestMockUi, alert) {
 }
 #endif
 
+#ifdef HAS_MOCK // mock_events is a mock browser hook
+// Prints messages/s and bytes/message of set_html/set_style and event traffic on both encodings
+TEST(TestMockUi, encoding_benchmark) {
+    constexpr auto count = 2000;
+    using Clock = std::chrono::steady_clock;
+    for(const auto encoding : {Gempyre::Ui::Encoding::Json, Gempyre::Ui::Encoding::MsgPack}) {
+        TEST_UI;
+        ui.set_encoding(encoding);
+        const auto name = encoding == Gempyre::Ui::Encoding::Json ? "JSON" : "MsgPack";
+        Gempyre::Element mock(ui, "mock");
+        int events = 0;
+        Gempyre::Ui::Traffic events_begin;
+        Clock::time_point events_start;
+        mock.subscribe("click", [&](const Gempyre::Event&) {
+            if(++events < count)
+                return;
+            const auto elapsed = std::chrono::duration<double>(Clock::now() - events_start).count();
+            const auto traffic = ui.traffic();
+            PRINT_D(name << " events: " << static_cast<int>(count / elapsed) << " messages/s "
+                << (traffic.bytes_received - events_begin.bytes_received) / (traffic.messages_received - events_begin.messages_received) << " bytes/message");
+            ui.exit();
+        });
+        ui.on_open([&]() {
+            EXPECT_EQ(ui.traffic().encoding, encoding);
+            const auto begin = ui.traffic();
+            const auto start = Clock::now();
+            for(auto i = 0; i < count; ++i) {
+                mock.set_html("<b>" + std::to_string(i) + "</b>");
+                mock.set_style("left", std::to_string(i) + "px");
+            }
+            (void) ui.ping(); // returns after the mock has got all
+            const auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+            const auto traffic = ui.traffic();
+            const auto messages = traffic.messages_sent - begin.messages_sent;
+            PRINT_D(name << " set_html/set_style: " << static_cast<int>(messages / elapsed) << " messages/s "
+                << (traffic.bytes_sent - begin.bytes_sent) / std::max<size_t>(1, messages) << " bytes/message");
+            events_begin = ui.traffic();
+            events_start = Clock::now();
+            ui.eval("mock_events(" + std::to_string(count) + ")");
+        });
+        const auto raii_ex = GempyreUtils::wait_expire(WaitExpireTimeout, [&]() {
+            const bool ok = events > 0;
+            HANDLE_EXPIRE;
+        });
+        ui.run();
+        EXPECT_EQ(events, count);
+    }
+}
+
+// Operations of an event loop round are sent as one message with repeated writes coalesced,
+// or as one message per operation if auto batch is off
+TEST(TestMockUi, auto_batch) {
+    constexpr auto count = 300;
+    for(const auto auto_batch : {true, false}) {
+        TEST_UI;
+        ui.set_auto_batch(auto_batch);
+        EXPECT_EQ(ui.is_auto_batch(), auto_batch);
+        Gempyre::Element mock(ui, "mock");
+        size_t messages = 0;
+        size_t coalesced = 0;
+        ui.on_open([&]() {
+            const auto begin = ui.traffic();
+            for(auto i = 0; i < count; ++i)
+                mock.set_attribute("value", std::to_string(i));
+            (void) ui.ping();
+            const auto traffic = ui.traffic();
+            messages = traffic.messages_sent - begin.messages_sent;
+            coalesced = traffic.operations_coalesced - begin.operations_coalesced;
+            ui.exit();
+        });
+        const auto raii_ex = GempyreUtils::wait_expire(WaitExpireTimeout, [&]() {
+            const bool ok = messages > 0;
+            HANDLE_EXPIRE;
+        });
+        ui.run();
+        if(auto_batch) {
+            EXPECT_LT(messages, 10U);
+            // the first value registers the element handle and stays, only the last one of the rest is sent
+            EXPECT_EQ(coalesced, static_cast<size_t>(count - 2));
+        } else {
+            EXPECT_GE(messages, static_cast<size_t>(count));
+            EXPECT_EQ(coalesced, 0U);
+        }
+    }
+}
+#endif
+
 //#ifndef RASPBERRY_OS
 
 TEST(TestMockUi, open) {
@@ -155,6 +155,22 @@ TEST_F(TestUi, setHTML) {
     });
 }
 
+TEST_F(TestUi, setHTMLPulled) {
+    Gempyre::Element el(ui(), "test-1");
+    const auto pulled = ui().traffic().messages_pulled;
+    // large enough to be fetched over HTTP, the child it creates is written right after
+    el.set_html("<div id=\"pulled-child\"></div><div hidden>" + std::string(5 * 1024 * 1024, 'x') + "</div>");
+    Gempyre::Element child(ui(), "pulled-child");
+    child.set_attribute("title", "after-pull");
+    test([this, child, pulled]() {
+        EXPECT_GT(ui().traffic().messages_pulled, pulled);
+        const auto attrs = child.attributes();
+        ASSERT_TRUE(attrs.has_value());
+        ASSERT_NE(attrs->find("title"), attrs->end());
+        ASSERT_EQ(attrs->at("title"), "after-pull");
+    });
+}
+
 TEST_F(TestUi, htmlStream) {
     Gempyre::Element el(ui(), "test-1");
     el.html_stream() <<  "Test-dyn" << 12;
@@ -292,6 +308,122 @@ TEST_F(TestUi, rect) {
       });
 }
 
+TEST_F(TestUi, queryAsync) {
+    int responses = 0;
+    ui().after(0s, [this, &responses]() {
+        Gempyre::Element el(ui(), "test-1");
+        el.rect_async([&responses](const auto& r) {
+            ASSERT_TRUE(r);
+            ASSERT_TRUE(r->width > 0 && r->height > 0);
+            ++responses;
+        });
+        el.type_async([this, &responses](const auto& t) {
+            ASSERT_TRUE(t);
+            ASSERT_EQ(*t, "div");
+            ++responses;
+            test_exit();
+        });
+    });
+    timeout(5s);
+    ASSERT_EQ(responses, 2);
+}
+
+TEST_F(TestUi, properties) {
+    test([this]() {
+        Gempyre::Element el(ui(), "test-1");
+        const auto children = el.children();
+        ASSERT_TRUE(children);
+        const auto props = ui().properties(*children, {"width", "height", "type"});
+        ASSERT_TRUE(props);
+        ASSERT_EQ(props->size(), children->size());
+        for(auto i = 0U; i < children->size(); ++i) {
+            ASSERT_EQ(props->at(i).first.id(), children->at(i).id());
+            ASSERT_EQ(props->at(i).second.size(), 3U);
+        }
+        const auto selected = ui().properties("#test-1", {"type", "attribute:id"});
+        ASSERT_TRUE(selected);
+        ASSERT_EQ(selected->size(), 1U);
+        ASSERT_EQ(selected->front().second.at("type"), "div");
+        ASSERT_EQ(selected->front().second.at("attribute:id"), "test-1");
+    });
+}
+
+TEST_F(TestUi, snapshot) {
+    test([this]() {
+        Gempyre::Element el(ui(), "test-1");
+        const auto node = el.snapshot({"value", "title"});
+        ASSERT_TRUE(node);
+        EXPECT_EQ(node->type, "div");
+        EXPECT_EQ(node->id, "test-1");
+        EXPECT_EQ(node->text, "Test-1");
+        EXPECT_EQ(node->attributes.at("value"), "Test-attr");
+        EXPECT_EQ(node->attributes.count("title"), 0U);
+        ASSERT_EQ(node->children.size(), 4U);
+        EXPECT_EQ(node->children[0].id, "test-child-0");
+        EXPECT_EQ(node->children[0].text, "c0");
+        const auto shallow = ui().root().snapshot({}, 0);
+        ASSERT_TRUE(shallow);
+        EXPECT_TRUE(shallow->children.empty());
+    });
+}
+
+TEST_F(TestUi, bind) {
+    Gempyre::Element el(ui(), "test-1");
+    Gempyre::Element other(ui(), "test-2");
+    bool ok = false;
+    ui().after(0s, [&]() {
+        using Action = Gempyre::Element::Action;
+        el.bind("click", {Action::add_class(other, "clicked"), Action::hide(other)}, [&](const Gempyre::Event&) {
+            const auto attributes = other.attributes();
+            ASSERT_TRUE(attributes);
+            EXPECT_EQ(attributes->at("class"), "clicked");
+            EXPECT_NE(attributes->find("hidden"), attributes->end());
+            ok = true;
+            test_exit();
+        });
+        ui().eval("document.getElementById(\"test-1\").click()");
+    });
+    timeout(5s);
+    ASSERT_TRUE(ok);
+}
+
+TEST_F(TestUi, mirror) {
+    Gempyre::Element el(ui(), "styled");
+    bool ok = false;
+    ui().after(0s, [&]() {
+        el.mirror({"attribute:title", "attribute:style", "innerHTML"});
+        ui().after(500ms, [&]() {
+            const auto html = el.mirrored("innerHTML");
+            ASSERT_TRUE(html);
+            ASSERT_EQ(html->value, "Unit tests");
+            el.set_attribute("title", "mirrored");
+            ASSERT_TRUE(el.mirrored("attribute:title")->stale);
+            ui().after(500ms, [&]() {
+                const auto title = el.mirrored("attribute:title");
+                ASSERT_TRUE(title);
+                ASSERT_FALSE(title->stale);
+                ASSERT_EQ(title->value, "mirrored");
+                ASSERT_FALSE(el.mirrored("value"));
+                // only the values a change affects are stale
+                el.set_style("color", "red");
+                ASSERT_FALSE(el.mirrored("attribute:title")->stale);
+                ASSERT_TRUE(el.mirrored("attribute:style")->stale);
+                ui().after(500ms, [&]() {
+                    const auto style = el.mirrored("attribute:style");
+                    ASSERT_TRUE(style);
+                    ASSERT_FALSE(style->stale);
+                    ASSERT_NE(style->value.find("red"), std::string::npos);
+                    el.mirror({});
+                    ok = true;
+                    test_exit();
+                });
+            });
+        });
+    });
+    timeout(5s);
+    ASSERT_TRUE(ok);
+}
+
 TEST_F(TestUi, resource) {
     const auto r = ui().resource("/apitests.html");
     ASSERT_TRUE(r);
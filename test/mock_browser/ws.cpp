@@ -3,6 +3,8 @@
 
 #include<cassert>
 #include <set>
+#include <deque>
+#include <vector>
 
 constexpr int BUFFER_SIZE{(1024 * 16) - 256};
 constexpr int RETRIES{10};
@@ -27,10 +29,10 @@ struct Connection {
     int port;
     std::string protocol;
     int interrupted;
-    unsigned char msg[BUFFER_SIZE];
-    int msg_size;
     websocket::App* extension;
     std::set<lws*>* m_connections; // if not ptr, not a POD, offset_of wont work
+    std::deque<std::pair<std::vector<unsigned char>, bool>>* m_outbox; // LWS_PRE padded message, is binary
+    std::string* m_inbox; // fragments of a message
     uint16_t retries = 10;
     lws_sorted_usec_list_t sul;
     lws_context* context;
@@ -40,10 +42,10 @@ struct Connection {
         port{port},
         protocol{protocol},
         interrupted{0},
-        msg{'\0'},
-        msg_size{0},
         extension{extension},
         m_connections{new std::set<lws*>},
+        m_outbox{new std::deque<std::pair<std::vector<unsigned char>, bool>>},
+        m_inbox{new std::string},
         retries{RETRIES},
         sul{},
         context{nullptr}
@@ -51,6 +53,8 @@ struct Connection {
     {}
     ~Connection(){
         delete m_connections;
+        delete m_outbox;
+        delete m_inbox;
     }
 };
 
@@ -86,10 +90,10 @@ connect_client(lws_sorted_usec_list_t *sul) {
 }
 
 static void
-send_message(Connection* c, const std::string& str) {
-    std::fill_n(c->msg, LWS_PRE + str.size() + 1U, '\0');
-    std::copy(str.begin(), str.end(), c->msg + LWS_PRE);
-    c->msg_size = static_cast<int>(str.size()) + 1;
+send_message(Connection* c, const std::string& str, bool binary) {
+    std::vector<unsigned char> msg(LWS_PRE + str.size() + (binary ? 0U : 1U), '\0'); // text is sent with null
+    std::copy(str.begin(), str.end(), msg.begin() + LWS_PRE);
+    c->m_outbox->emplace_back(std::move(msg), binary);
 }
 
 static int
@@ -127,17 +131,22 @@ callback(lws* wsi, lws_callback_reasons reason, void* user, void* in, size_t len
         mco->interrupted = 1;
         mco->m_connections->erase(wsi);
         break;
-    case LWS_CALLBACK_CLIENT_WRITEABLE:
-        if(mco->msg_size == 0)
+    case LWS_CALLBACK_CLIENT_WRITEABLE: {
+        if(mco->m_outbox->empty())
             return 0;
         lwsl_user("%s: WRITEABLE\n", __func__);
-        m = lws_write(wsi, mco->msg + LWS_PRE, mco->msg_size, LWS_WRITE_TEXT); //+ 1 is for null
-        if (m < mco->msg_size) {
+        auto& [msg, binary] = mco->m_outbox->front();
+        const auto msg_size = static_cast<int>(msg.size() - LWS_PRE);
+        m = lws_write(wsi, msg.data() + LWS_PRE, static_cast<size_t>(msg_size), binary ? LWS_WRITE_BINARY : LWS_WRITE_TEXT);
+        if (m < msg_size) {
             lwsl_err("sending message failed: %d\n", m);
             return 0;
         }
-        mco->msg_size = 0;
+        mco->m_outbox->pop_front();
+        if(!mco->m_outbox->empty())
+            lws_callback_on_writable(wsi);
         break;
+    }
 
     case LWS_CALLBACK_TIMER:
         // Let the main loop know we want to send another message to the
@@ -146,7 +155,12 @@ callback(lws* wsi, lws_callback_reasons reason, void* user, void* in, size_t len
         break;
 
     case LWS_CALLBACK_CLIENT_RECEIVE:
-        pj =  mco->extension->received(static_cast<const char*>(in));
+        if(lws_is_first_fragment(wsi))
+            mco->m_inbox->clear();
+        mco->m_inbox->append(static_cast<const char*>(in), len);
+        if(!lws_is_final_fragment(wsi) || lws_remaining_packet_payload(wsi) > 0)
+            break;
+        pj =  mco->extension->received(mco->m_inbox->data(), mco->m_inbox->size(), lws_frame_is_binary(wsi) != 0);
         if(pj < 0) {
             lwsl_notice("Unexpexted message, %d : %s", pj, static_cast<const char*>(in));
         } else if (pj > 0) {
@@ -214,10 +228,8 @@ int websocket::start_ws(const std::string& address, int port, const std::string&
         lws_cancel_service(mco->context);
     };
 
-    ext.send_message = [&mco](const std::string& msg) {
-         if(msg.size() > BUFFER_SIZE)
-             return false;
-         send_message(mco.get(), msg);
+    ext.send_message = [&mco](const std::string& msg, bool binary) {
+         send_message(mco.get(), msg, binary);
          for(const auto& wsi : *mco->m_connections)
             lws_callback_on_writable(wsi);
          return !mco->m_connections->empty();
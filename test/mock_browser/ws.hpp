@@ -11,10 +11,11 @@ namespace websocket {
     enum class Status{Error, Established};
     class App {
     public:
-        int received(const char* cstr);
+        int received(const char* data, size_t len, bool binary);
         bool on_status(Status status);
         std::function<void ()> exit = nullptr;
-        std::function<bool (const char* cstr)> send_message = nullptr;
+        std::function<bool (const std::string& msg, bool binary)> send_message = nullptr;
+        bool packed = false; // server accepted MessagePack
     };
     int start_ws(const std::string& address, int port, const std::string& protocol, App& ext);
     void debug_print(int, const char* cstr);
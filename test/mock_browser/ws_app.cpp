@@ -3,6 +3,7 @@
 #include <iostream>
 #include <chrono>
 #include <thread>
+#include <regex>
 
 using namespace std::chrono_literals;
 
@@ -10,16 +11,29 @@ using namespace std::chrono_literals;
 using namespace websocket;
 using Json = nlohmann::json;
 
+static bool send(App& app, const Json& msg) {
+    if(app.packed) {
+        std::string bytes;
+        Json::to_msgpack(msg, bytes);
+        return app.send_message(bytes, true);
+    }
+    return app.send_message(msg.dump(), false);
+}
+
+// messages are maps, bitmaps start with an uint32 type
+static bool is_msgpack(const char* data, size_t len) {
+    const auto c = len > 0 ? static_cast<unsigned char>(data[0]) : 0;
+    return (c & 0xF0) == 0x80 || c == 0xDE || c == 0xDF;
+}
+
 bool App::on_status(websocket::Status status) {
     switch(status) {
         case websocket::Status::Error: {
-            const auto err = Json({{"type", "error"}}).dump();
-            send_message(err.c_str());
+            send(*this, Json({{"type", "error"}}));
             return true;
         }
         case websocket::Status::Established: {
-            const auto ready = Json({{"type", "ui_ready"}}).dump();
-            send_message(ready.c_str());
+            send(*this, Json({{"type", "ui_ready"}, {"encodings", {"msgpack"}}}));
             //const auto event = Json({{"type", "event"}, {"element", ""}, {"event", "ui_ready"}, {"properties", Json::object()}}).dump();
             //send_message(event.c_str());
             return true;
@@ -35,27 +49,56 @@ void websocket::debug_print(int lvl, const char* cstr) {
         std::cout << lvl << ":" << cstr << std::endl;
 }
 
-int App::received(const char* cstr) {
-    const auto js = Json::parse(cstr);
-    if(js["type"] == "exit_request") {
-        exit();
+static void handle(App& app, const Json& js) {
+    const auto type = js.value("type", std::string{});
+    if(type == "batch") {
+        for(const auto& item : js["batches"])
+            handle(app, item);
+        return;
+    }
+    if(type == "exit_request") {
+        app.exit();
     }
-    if(js["type"] == "close_request") {
-        exit();
+    if(type == "close_request") {
+        app.exit();
     }
-    if(js["type"] == "query") {
+    if(type == "encoding") {
+        app.packed = js["encoding"] == "msgpack";
+    }
+    if(type == "query") {
         if(js["query"] == "ping") {
             const auto epoch = std::chrono::duration_cast<std::chrono::milliseconds>
             (std::chrono::system_clock::now().time_since_epoch()).count();
-            const auto msg = Json({{"type", "query"},
+            send(app, Json({{"type", "query"},
                                          {"query_id", js["query_id"]},
                                          {"query_value", "pong"},
                                          {"pong", epoch}
-                                      }).dump();
-            send_message(msg.c_str());
+                                      }));
+        }
+    }
+    // benchmark hook: eval("mock_events(count)") sends count click events to element "mock"
+    if(type == "eval") {
+        std::smatch m;
+        const auto eval = js["eval"].get<std::string>();
+        if(std::regex_match(eval, m, std::regex(R"(mock_events\((\d+)\))"))) {
+            const auto count = std::stoi(m[1].str());
+            for(auto i = 0; i < count; ++i) {
+                send(app, Json({{"type", "event"},
+                                {"element", "mock"},
+                                {"event", "click"},
+                                {"properties", {{"clientX", std::to_string(i)}, {"clientY", std::to_string(count - i)}}}
+                               }));
+            }
         }
     }
+}
+
+int App::received(const char* data, size_t len, bool binary) {
+    if(binary && !is_msgpack(data, len))
+        return 0; // bitmaps are ignored
+    const auto js = binary ? Json::from_msgpack(data, data + len) : Json::parse(data, data + len);
+    handle(*this, js);
    if((1 << 3) <= WS_LOG_LEVEL)
-        std::cout << (1 << 3) << ": app-received: " << cstr << std::endl;
+        std::cout << (1 << 3) << ": app-received: " << js.dump() << std::endl;
     return 0;
 }
@@ -4,6 +4,14 @@
 #include "gempyre.h"
 #include "gempyre_graphics.h"
 #include "timequeue.h"
+#include "quality.h"
+#include "gempyre_pyramid.h"
+#include "canvas_data.h"
+#include "batch.h"
+#include "send_queue.h"
+#include "input_queue.h"
+#include "gempyre_internal.h"
+#include <filesystem>
 
 TEST(Unittests, Test_rgb) {
     auto col1 = Gempyre::Color::rgba(0x33, 0x44, 0x55);
@@ -558,6 +566,436 @@ TEST(Unittests, json_test_set4) {
     ASSERT_EQ(*js, R"({"animals":[{"cat":"meow","food":"fish"},{"dog":"bark","food":"bone"}]})");
 }
 
+TEST(Unittests, frame_optimize) {
+    Gempyre::FrameComposer fc;
+    fc.fill_style("red");
+    fc.fill_rect(0, 0, 10, 10);
+    fc.fill_style("red");           // redundant
+    fc.fill_rect(10, 0, 10, 10);    // joins with previous
+    fc.save();
+    fc.line_width(2);               // dropped by restore
+    fc.restore();                   // empty pair
+    fc.stroke_style("blue");        // overridden
+    fc.stroke_style("green");
+    fc.stroke_rect(0, 0, 5, 5);
+    fc.fill_style("red");           // redundant
+    fc.fill_text("hello", 1, 1);
+    EXPECT_EQ(fc.optimize(), 7U);
+    const Gempyre::CanvasElement::CommandList expected{
+        "fillStyle", "red",
+        "fillRect", 0., 0., 20., 10.,
+        "strokeStyle", "green",
+        "strokeRect", 0., 0., 5., 5.,
+        "fillText", "hello", 1., 1.};
+    EXPECT_EQ(fc.composed(), expected);
+    EXPECT_EQ(fc.optimize(), 0U);
+}
+
+TEST(Unittests, frame_optimize_state) {
+    Gempyre::FrameComposer fc;
+    fc.fill_style("red");
+    fc.save();
+    fc.fill_style("blue");
+    fc.fill_rect(0, 0, 10, 10);
+    fc.restore();
+    fc.fill_style("red");           // restored value
+    fc.fill_rect(0, 10, 10, 10);    // not joined, style differs
+    fc.restore();                   // unknown state after this
+    fc.fill_style("red");
+    EXPECT_EQ(fc.optimize(), 1U);
+    EXPECT_EQ(fc.composed().size(), 19U);
+
+    Gempyre::CanvasElement::CommandList unknown{"fillStyle", "red", "fillStyle", "red", "foo"};
+    Gempyre::FrameComposer fu(unknown);
+    EXPECT_EQ(fu.optimize(), 0U);
+    EXPECT_EQ(fu.composed(), unknown);
+}
+
+TEST(Unittests, quality_controller) {
+    using Quality = Gempyre::CanvasElement::Quality;
+    using namespace std::chrono_literals;
+    Gempyre::QualityController qc;
+    auto now = Gempyre::QualityController::Clock::now();
+    constexpr size_t frame = 500000;
+    // socket is saturated and drains 1MB/s while a frame is written each 100ms
+    size_t written = 0;
+    size_t buffered = 0;
+    for(int i = 0; i < 10; ++i) {
+        written += frame;
+        buffered += frame - 100000;
+        qc.update({buffered, 0, written}, frame, now);
+        now += 100ms;
+    }
+    EXPECT_EQ(qc.level(), Quality::Minimal);
+    ASSERT_TRUE(qc.capacity());
+    EXPECT_NEAR(*qc.capacity(), 1000000., 1.);
+
+    // backlog drains
+    now += 4s;
+    buffered = 0;
+    qc.update({buffered, 0, written}, frame, now);
+    EXPECT_EQ(qc.level(), Quality::Minimal);
+    now += 500ms;
+    qc.update({buffered, 0, written}, frame, now);
+    EXPECT_EQ(qc.level(), Quality::Minimal);
+    // recovery happens a level at the time
+    now += 600ms;
+    qc.update({buffered, 0, written}, frame, now);
+    EXPECT_EQ(qc.level(), Quality::Lossy);
+    now += 1100ms;
+    qc.update({buffered, 0, written}, frame, now);
+    EXPECT_EQ(qc.level(), Quality::Lossy);  // next level frame does not fit into the capacity
+    now += 4000ms;
+    qc.update({buffered, 0, written}, frame, now);
+    EXPECT_EQ(qc.level(), Quality::Reduced); // but it is probed eventually
+    EXPECT_FALSE(qc.capacity());
+    now += 1100ms;
+    qc.update({buffered, 0, written}, frame, now);
+    EXPECT_EQ(qc.level(), Quality::Full);
+}
+
+TEST(Unittests, pyramid_build) {
+    constexpr auto width = 10;
+    constexpr auto height = 7;
+    const auto path = (std::filesystem::temp_directory_path() / "gempyre_unittest.pyr").string();
+    ASSERT_TRUE(Gempyre::Pyramid::build(path, width, height, [](int y, Gempyre::Color::type* row) {
+        for(auto x = 0; x < width; ++x)
+            row[x] = Gempyre::Color::rgba(static_cast<Gempyre::dataT>(x * 10), static_cast<Gempyre::dataT>(y * 10), 0);
+        return true;
+    }, 4));
+    {
+        const auto pyramid = Gempyre::Pyramid::open(path);
+        ASSERT_TRUE(pyramid);
+        EXPECT_EQ(pyramid->width(), width);
+        EXPECT_EQ(pyramid->height(), height);
+        ASSERT_EQ(pyramid->levels(), 3); // 10x7, 5x4, 3x2
+        EXPECT_EQ(pyramid->level_width(1), 5);
+        EXPECT_EQ(pyramid->level_height(1), 4);
+        EXPECT_EQ(pyramid->tiles_x(0), 3);
+        EXPECT_EQ(pyramid->tiles_y(0), 2);
+        EXPECT_EQ(pyramid->tiles_x(2), 1);
+        EXPECT_FALSE(pyramid->tile(0, 3, 0));
+        // pixel 9,6 is on tile 2,1 at 1,2
+        const auto edge = pyramid->tile(0, 2, 1);
+        ASSERT_TRUE(edge);
+        EXPECT_EQ(edge[1 + 2 * 4], Gempyre::Color::rgba(90, 60, 0));
+        EXPECT_EQ(edge[2 + 2 * 4], 0U); // padding
+        // level 1 pixel 4,3 averages 8..9 x 6 as 7 is out
+        const auto half = pyramid->tile(1, 1, 0);
+        ASSERT_TRUE(half);
+        EXPECT_EQ(half[0 + 3 * 4], Gempyre::Color::rgba(85, 60, 0));
+        // level 1 pixel 1,1 averages 2..3 x 2..3
+        EXPECT_EQ(pyramid->tile(1, 0, 0)[1 + 1 * 4], Gempyre::Color::rgba(25, 25, 0));
+        // level 2 pixel 0,0 averages level 1 0..1 x 0..1
+        EXPECT_EQ(pyramid->tile(2, 0, 0)[0], Gempyre::Color::rgba(15, 15, 0));
+    }
+    std::filesystem::remove(path);
+    EXPECT_FALSE(Gempyre::Pyramid::open(path));
+}
+
+TEST(Unittests, data_handle) {
+    Gempyre::CanvasData canvas(2, 2, "a_long_generated_canvas_id");
+    canvas.put(1, 1, Gempyre::Color::Red);
+    canvas.ref().writeHeader({0, 0, 2, 2, 1});
+    EXPECT_EQ(canvas.ref().owner(), "a_long_generated_canvas_id");
+    const auto size = canvas.ref().size();
+    canvas.ref().setHandle(0xAAB, 7);
+    EXPECT_EQ(canvas.ref().type(), 0xAABU);
+    EXPECT_LT(canvas.ref().size(), size);
+    EXPECT_EQ(canvas.get(1, 1), Gempyre::Color::Red);
+    EXPECT_EQ(canvas.ref().header(), std::vector<Gempyre::dataT>({0, 0, 2, 2, 1}));
+    const auto [bytes, len] = canvas.ref().payload();
+    const auto words = reinterpret_cast<const Gempyre::dataT*>(bytes);
+    EXPECT_EQ(words[2], 2U); // handle is two 16 bit words
+    EXPECT_EQ(words[len / sizeof(Gempyre::dataT) - 1], 7U);
+}
+
+TEST(Unittests, batch_encode) {
+    using json = nlohmann::json;
+    Gempyre::Batch batch({true, true});
+    const auto style = [](const std::string& value) {
+        return json{{"type", "set_style"}, {"element", "a"}, {"style", "left"}, {"value", value}};
+    };
+    EXPECT_EQ(batch.push_back(style("1")), 0U);
+    EXPECT_EQ(batch.push_back(json{{"type", "html"}, {"element", "b"}, {"html", "x"}}), 0U);
+    EXPECT_EQ(batch.push_back(style("2")), 1U);
+    EXPECT_EQ(batch.push_back(json{{"type", "create"}, {"element", "a"}}), 0U);
+    EXPECT_EQ(batch.push_back(style("3")), 0U); // not over create
+    EXPECT_EQ(batch.size(), 5U);
+    const auto message = batch.take();
+    EXPECT_EQ(message.operations, 4U);
+    const json expected{{"type", "batch"}, {"batches", {
+        {{"type", "html"}, {"element", "b"}, {"html", "x"}},
+        style("2"),
+        {{"type", "create"}, {"element", "a"}},
+        style("3")}}};
+    EXPECT_EQ(json::parse(message.text), expected);
+    EXPECT_EQ(json::from_msgpack(message.packed), expected);
+    EXPECT_EQ(batch.size(), 0U);
+    EXPECT_EQ(batch.take().operations, 0U);
+    batch.push_back(style("4"));
+    EXPECT_EQ(json::parse(batch.take().text), json({{"type", "batch"}, {"batches", {style("4")}}}));
+
+    // ids may contain separators, different elements and properties are not merged
+    EXPECT_EQ(batch.push_back(json{{"type", "set_style"}, {"element", "a"}, {"style", "b/html"}, {"value", "1"}}), 0U);
+    EXPECT_EQ(batch.push_back(json{{"type", "html"}, {"element", "a/style/b"}, {"html", "x"}}), 0U);
+    EXPECT_EQ(batch.push_back(json{{"type", "set_attribute"}, {"element", "a"}, {"attribute", "left"}, {"value", "1"}}), 0U);
+    EXPECT_EQ(batch.take().operations, 3U);
+}
+
+TEST(Unittests, send_queue_order) {
+    struct Socket {
+        size_t capacity{16};
+        size_t buffered{0};
+        std::string stream{};
+    };
+    using Queue = Gempyre::SendQueue<Socket>;
+    static constexpr size_t fragment = 8;
+    const auto writer = [](Socket* s, Queue::Message& message) {
+        const auto data = message.payload();
+        const auto len = std::min(fragment, data.size() - message.offset);
+        if(s->buffered + len > s->capacity)
+            return Queue::Status::Blocked;
+        s->stream.append(data.substr(message.offset, len));
+        s->buffered += len;
+        message.offset += len;
+        return s->buffered >= s->capacity ? Queue::Status::Backpressure : Queue::Status::Sent;
+    };
+    std::vector<uint64_t> written;
+    const auto done = [&written](Socket*, Queue::Message&& message) {written.push_back(message.seq);};
+    const auto resend = [](Socket*) {FAIL();};
+    const auto data = [](char c, size_t words) {
+        auto ptr = std::make_shared<Gempyre::Data>(words, 0xAAA, "c", std::vector<Gempyre::dataT>{0, 0, 1, 1, 0});
+        std::fill(ptr->begin(), ptr->end(), static_cast<Gempyre::dataT>(c) * 0x01010101U);
+        return ptr;
+    };
+
+    Socket socket;
+    Queue queue;
+    const auto frame = data('f', 2);
+    const auto first = queue.push(&socket, "text-1", false);
+    queue.push(&socket, frame, false);
+    const auto style = queue.push(&socket, "style-1", false);
+    queue.push(&socket, data('d', 1), true);
+    queue.push(&socket, data('e', 1), true);
+    const auto last = queue.push(&socket, "style-2", true);
+    EXPECT_EQ(queue.queued(), 6U + frame->size() + 7U + 2 * data('d', 1)->size() + 7U);
+
+    queue.send(nullptr, writer, done, resend);
+    EXPECT_EQ(written, std::vector<uint64_t>({first}));
+    EXPECT_EQ(queue.dropped(), 2U); // congested, droppable frames are skipped
+    for(auto rounds = 0; !queue.empty() && rounds < 100; ++rounds) {
+        socket.buffered = 0; // drain
+        queue.send(&socket, writer, done, resend);
+    }
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(queue.queued(), 0U);
+    // style is not written before the frame queued before it
+    EXPECT_EQ(written, std::vector<uint64_t>({first, first + 1, style, last}));
+    const auto [bytes, len] = frame->payload();
+    EXPECT_EQ(socket.stream, "text-1" + std::string(bytes, len) + "style-1" + "style-2");
+}
+
+TEST(Unittests, send_queue_lanes) {
+    struct Socket {};
+    using Queue = Gempyre::SendQueue<Socket>;
+    const auto writer = [](Socket*, Queue::Message& message) {
+        message.offset = std::min(message.size(), message.offset + 4); // 4 bytes per write
+        return Queue::Status::Sent;
+    };
+    std::vector<std::string> written;
+    const auto done = [&written](Socket*, Queue::Message&& message) {written.push_back(message.text);};
+    const auto resend = [](Socket*) {FAIL();};
+    Socket socket;
+    Queue queue;
+    queue.push(&socket, "bulk-1", false, Queue::Lane::Bulk);
+    queue.push(&socket, "query-1", false);
+    queue.push(&socket, "bulk-2", false, Queue::Lane::Bulk);
+    queue.push(&socket, "query-2", false);
+    queue.send(nullptr, writer, done, resend);
+    EXPECT_EQ(written, std::vector<std::string>({"query-1", "query-2", "bulk-1", "bulk-2"}));
+    EXPECT_EQ(queue.delay(Queue::Lane::Interactive).messages, 2U);
+    EXPECT_EQ(queue.delay(Queue::Lane::Bulk).messages, 2U);
+
+    // a started bulk message is completed before an interactive one
+    written.clear();
+    queue.push(&socket, "bulk-long", false, Queue::Lane::Bulk);
+    const auto one_part = [&writer](Socket* s, Queue::Message& message) {
+        return message.offset == 0 ? (writer(s, message), Queue::Status::Backpressure) : Queue::Status::Blocked;};
+    queue.send(nullptr, one_part, done, resend);
+    queue.push(&socket, "query-3", false);
+    queue.send(nullptr, writer, done, resend);
+    EXPECT_EQ(written, std::vector<std::string>({"bulk-long", "query-3"}));
+
+    // bulk is not starved
+    written.clear();
+    queue.push(&socket, "bulk-3", false, Queue::Lane::Bulk);
+    for(auto i = 0U; i < Queue::STARVATION_RUN + 1; ++i)
+        queue.push(&socket, "q", false);
+    queue.send(nullptr, writer, done, resend);
+    ASSERT_EQ(written.size(), Queue::STARVATION_RUN + 2);
+    EXPECT_EQ(written[Queue::STARVATION_RUN], "bulk-3");
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(Unittests, send_queue_bitmap_lanes) {
+    struct Socket {};
+    using Queue = Gempyre::SendQueue<Socket>;
+    const auto writer = [](Socket*, Queue::Message& message) {
+        message.offset = message.size();
+        return Queue::Status::Sent;
+    };
+    std::vector<uint64_t> written;
+    const auto done = [&written](Socket*, Queue::Message&& message) {written.push_back(message.seq);};
+    const auto resend = [](Socket*) {FAIL();};
+    const auto frame = std::make_shared<Gempyre::Data>(1, 0xAAA, "c", std::vector<Gempyre::dataT>{0, 0, 1, 1, 0});
+    Socket socket;
+    Queue queue;
+    // a frame that can be dropped is bulk and may be overtaken, a default one keeps its order with DOM updates
+    const auto droppable = queue.push(&socket, frame, true, Queue::Lane::Bulk);
+    const auto kept = queue.push(&socket, frame, false);
+    const auto remove = queue.push(&socket, "remove", false);
+    queue.send(nullptr, writer, done, resend);
+    EXPECT_EQ(written, std::vector<uint64_t>({kept, remove, droppable}));
+}
+
+TEST(Unittests, input_queue_coalesce) {
+    using Queue = Gempyre::InputQueue;
+    using Coalesce = Gempyre::Element::Coalesce;
+    const auto move = [](const char* element, int x, int dx) {
+        return Queue::Event{element, "mousemove", Gempyre::Server::Object{{"x", x}, {"dx", dx}}};
+    };
+    Queue queue;
+    queue.set_policy("latest", "mousemove", Coalesce::Latest);
+    queue.set_policy("ends", "mousemove", Coalesce::FirstAndLast);
+    queue.set_policy("sum", "mousemove", Coalesce::Accumulate, {"dx"});
+    for(auto i = 1; i <= 4; ++i) {
+        queue.push(move("latest", i, 1));
+        queue.push(move("ends", i, 1));
+        queue.push(move("sum", i, 1));
+        queue.push(move("all", i, 1));
+    }
+    EXPECT_EQ(queue.max_size(), 8U);
+    EXPECT_EQ(queue.coalesced(), 8U);
+    std::vector<std::pair<std::string, int>> taken;
+    std::unordered_map<std::string, double> dx;
+    while(!queue.empty()) {
+        const auto event = queue.take();
+        taken.emplace_back(event.element, event.data.at("x").get<int>());
+        dx[event.element] += event.data.at("dx").get<double>();
+    }
+    // a merged event keeps the place of the first waiting one
+    const std::vector<std::pair<std::string, int>> expected{
+        {"latest", 4}, {"ends", 1}, {"sum", 4}, {"all", 1}, {"ends", 4}, {"all", 2}, {"all", 3}, {"all", 4}};
+    EXPECT_EQ(taken, expected);
+    EXPECT_EQ(dx["sum"], 4.0);
+    EXPECT_EQ(dx["latest"], 1.0);
+
+    // taken events are not merged into
+    queue.push(move("latest", 5, 1));
+    EXPECT_EQ(queue.take().data.at("x"), 5);
+    queue.push(move("latest", 6, 1));
+    EXPECT_EQ(queue.size(), 1U);
+    EXPECT_EQ(queue.take().data.at("x"), 6);
+
+    // integer deltas are summed as integers, others as doubles
+    queue.push(move("sum", 7, 2));
+    queue.push(move("sum", 8, 3));
+    const auto ints = queue.take().data.at("dx");
+    EXPECT_TRUE(ints.is_number_integer());
+    EXPECT_EQ(ints.get<int64_t>(), 5);
+    queue.push(Queue::Event{"sum", "mousemove", Gempyre::Server::Object{{"dx", 2}}});
+    queue.push(Queue::Event{"sum", "mousemove", Gempyre::Server::Object{{"dx", 0.5}}});
+    EXPECT_EQ(queue.take().data.at("dx").get<double>(), 2.5);
+}
+
+TEST(Unittests, pointer_stream) {
+    const auto put = [](std::string& bytes, const auto& value) {
+        bytes.append(reinterpret_cast<const char*>(&value), sizeof(value)); // tests run on little endian
+    };
+    const auto frame = [&put](uint32_t count, uint32_t idLen, const std::string& id) {
+        std::string bytes;
+        put(bytes, uint32_t{0xB01});
+        put(bytes, count);
+        put(bytes, idLen);
+        bytes += id;
+        bytes.resize((bytes.size() + 3) & ~size_t{3}, '\0');
+        for(auto i = 0U; i < count; ++i) {
+            put(bytes, 1000.5 + i);
+            put(bytes, 10.f * static_cast<float>(i));
+            put(bytes, 20.f);
+            put(bytes, 0.5f);
+            put(bytes, uint32_t{1});
+            put(bytes, uint32_t{7});
+            put(bytes, static_cast<uint32_t>(Gempyre::PointerSample::Kind::Move));
+        }
+        return bytes;
+    };
+
+    const auto good = frame(2, 5, "pad01");
+    const auto message = Gempyre::Server::pointerStream(good);
+    ASSERT_TRUE(message);
+    ASSERT_FALSE(message->empty());
+    EXPECT_EQ(message->at("element"), "pad01");
+    EXPECT_EQ(message->at("event"), Gempyre::Server::POINTER_STREAM);
+    const auto samples = Gempyre::GempyreInternal::to_samples(message->at("properties").at("samples").get_binary());
+    ASSERT_EQ(samples.size(), 2U);
+    EXPECT_EQ(samples[1].timestamp, 1001.5);
+    EXPECT_EQ(samples[1].x, 10.f);
+    EXPECT_EQ(samples[1].y, 20.f);
+    EXPECT_EQ(samples[1].pressure, 0.5f);
+    EXPECT_EQ(samples[1].buttons, 1U);
+    EXPECT_EQ(samples[1].pointer_id, 7U);
+    EXPECT_EQ(samples[1].kind, Gempyre::PointerSample::Kind::Move);
+
+    // truncated frame is rejected as an empty message
+    const auto truncated = Gempyre::Server::pointerStream(good.substr(0, good.size() - 4));
+    ASSERT_TRUE(truncated);
+    EXPECT_TRUE(truncated->empty());
+    // so is an id length beyond the frame, also one that wraps around when padded
+    for(const auto idLen : {64U, 0xFFFFFFFFU}) {
+        auto bad = frame(0, 0, "");
+        std::memcpy(&bad[8], &idLen, sizeof(idLen));
+        const auto invalid = Gempyre::Server::pointerStream(bad);
+        ASSERT_TRUE(invalid);
+        EXPECT_TRUE(invalid->empty());
+    }
+    // other binaries are not pointer streams
+    EXPECT_FALSE(Gempyre::Server::pointerStream(std::string(16, '\0')));
+}
+
+TEST(Unittests, event_properties) {
+    const auto data = std::make_shared<const Gempyre::EventData>(Gempyre::EventData{
+        Gempyre::Server::Object{{"clientX", 12.5}, {"ctrlKey", true}, {"key", "Enter"}, {"value", "42"},
+            {"fraction", 3.5}, {"negative", -1}, {"large", 1e20}, {"negative_text", "-1"}}});
+    const Gempyre::EventProperties properties{data};
+    EXPECT_EQ(properties.get<double>("clientX"), 12.5);
+    EXPECT_EQ(properties.get<int>("negative"), -1);
+    EXPECT_EQ(properties.get<long long>("value"), 42);
+    // not representable
+    EXPECT_FALSE(properties.get<int>("clientX"));
+    EXPECT_FALSE(properties.get<int>("fraction"));
+    EXPECT_FALSE(properties.get<unsigned>("negative"));
+    EXPECT_FALSE(properties.get<unsigned>("negative_text"));
+    EXPECT_FALSE(properties.get<int>("large"));
+    EXPECT_TRUE(properties.get<float>("large"));
+    EXPECT_EQ(properties.get<bool>("ctrlKey"), true);
+    EXPECT_EQ(properties.get<std::string>("key"), "Enter");
+    EXPECT_EQ(properties.get<int>("value"), 42);     // strings are parsed
+    EXPECT_FALSE(properties.get<double>("key"));
+    EXPECT_FALSE(properties.get<double>("clientY"));
+    // string view
+    EXPECT_EQ(properties.size(), 8U);
+    EXPECT_EQ(properties.at("key"), "Enter");
+    EXPECT_EQ(properties.at("ctrlKey"), "true");
+    EXPECT_EQ(GempyreUtils::parse<double>(properties.at("clientX")), 12.5);
+
+    const Gempyre::EventProperties strings{Gempyre::EventProperties::map_type{{"value", "7"}, {"fraction", "3.5"}}};
+    EXPECT_EQ(strings.get<unsigned>("value"), 7U);
+    EXPECT_FALSE(strings.get<int>("fraction"));
+    EXPECT_EQ(strings.at("value"), "7");
+}
+
 int main(int argc, char **argv) {
    ::testing::InitGoogleTest(&argc, argv);
    for(int i = 1 ; i < argc; ++i)